@@ -0,0 +1,26 @@
+# Training run for the pgo target (see CMakeLists.txt), run with cmake -P.
+# Expects CILISP, TRAINING, BUILD_DIR, PROFILE_DIR and, for clang, LLVM_PROFDATA.
+
+# drop the profile of any earlier training run so only this one counts
+file(GLOB_RECURSE oldProfile ${BUILD_DIR}/*.gcda ${PROFILE_DIR}/*.profraw)
+if (oldProfile)
+    file(REMOVE ${oldProfile})
+endif ()
+
+execute_process(COMMAND ${CILISP} ${TRAINING} OUTPUT_QUIET RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "Training run of ${CILISP} on ${TRAINING} failed: ${result}")
+endif ()
+
+# clang leaves raw profiles that have to be merged before -fprofile-use can read them
+file(GLOB rawProfile ${PROFILE_DIR}/*.profraw)
+if (rawProfile)
+    if (NOT LLVM_PROFDATA)
+        message(FATAL_ERROR "llvm-profdata is needed to merge the profile in ${PROFILE_DIR}")
+    endif ()
+    execute_process(COMMAND ${LLVM_PROFDATA} merge -output=${PROFILE_DIR}/cilisp.profdata ${rawProfile}
+            RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "Merging the profile in ${PROFILE_DIR} failed: ${result}")
+    endif ()
+endif ()
@@ -1,67 +1,130 @@
 #include "ciLisp.h"
+#include "ciLispVM.h"
 #include <stdio.h>
 
-void yyerror(char *s) {
-    fprintf(stderr, "\nERROR: %s\n", s);
-    // note stderr that normally defaults to stdout, but can be redirected: ./src 2> src.log
-    // CLion will display stderr in a different color from stdin and stdout
-}
+#ifdef CILISP_TRACE
+TRACE_LEVEL traceLevel = TRACE_NONE;
+#endif
 
-// Array of string values for operations.
-// Must be in sync with funcs in the OPER_TYPE enum in order for resolveFunc to work.
-char *funcNames[] = {
-        "read",
-        "rand",
+_Thread_local CILISP *cilisp = NULL;
+
+void yyerror(char *s) {
+    // the interpreter's sink, like every other diagnostic; stderr only before one is running
+    fprintf(cilisp ? cilisp->out : stderr, "\nERROR: %s\n", s);
+}
+
+// Every word the scanner gives a token of its own, in the order internBuiltins() reserves their ATOMs:
+// the builtin functions in OPER_TYPE order, then the types in NUM_TYPE order, then the keywords.
+// This is the only list of them. The scanner, resolveFunc() and resolveType() all look words up here
+// by the ATOM the scanner interns anyway, so a lookup is an array index rather than a string search.
+typedef struct {
+    char *name;
+    int token;
+    int value; // the OPER_TYPE of a FUNC, the NUM_TYPE of a TYPE
+} BUILTIN;
+
+static BUILTIN builtins[] = {
+        {"read", FUNC, READ_OPER},
+        {"rand", FUNC, RAND_OPER},
         //nonary <= rand
-        "neg",
-        "abs",
-        "exp",
-        "sqrt",
-        "log",
-        "exp2",
-        "cbrt",
+        {"neg", FUNC, NEG_OPER},
+        {"abs", FUNC, ABS_OPER},
+        {"exp", FUNC, EXP_OPER},
+        {"sqrt", FUNC, SQRT_OPER},
+        {"log", FUNC, LOG_OPER},
+        {"exp2", FUNC, EXP2_OPER},
+        {"cbrt", FUNC, CBRT_OPER},
         //unary <= cbrt
-        "remainder",
-        "pow",
-        "max",
-        "min",
-        "hypot",
-        "equal",
-        "less",
-        "greater",
+        {"remainder", FUNC, REMAINDER_OPER},
+        {"pow", FUNC, POW_OPER},
+        {"max", FUNC, MAX_OPER},
+        {"min", FUNC, MIN_OPER},
+        {"hypot", FUNC, HYPOT_OPER},
+        {"equal", FUNC, EQUAL_OPER},
+        {"less", FUNC, LESS_OPER},
+        {"greater", FUNC, GREATER_OPER},
         //binary <= greater
-        "add",
-        "sub",
-        "mult",
-        "div",
-        "print",
-
-        ""
+        {"add", FUNC, ADD_OPER},
+        {"sub", FUNC, SUB_OPER},
+        {"mult", FUNC, MULT_OPER},
+        {"div", FUNC, DIV_OPER},
+        {"print", FUNC, PRINT_OPER},
+
+        {"int", TYPE, INT_TYPE},
+        {"double", TYPE, DOUBLE_TYPE},
+
+        {"let", LET, 0},
+        {"cond", COND, 0},
+        {"lambda", LAMBDA, 0},
+        {"quit", QUIT, 0}
 };
 
-OPER_TYPE resolveFunc(char *funcName) {
-    int i = 0;
-    while (funcNames[i][0] != '\0') {
-        if (strcmp(funcNames[i], funcName) == 0)
-            return i;
-        i++;
+#define NUM_BUILTINS ((ATOM) (sizeof(builtins) / sizeof(builtins[0])))
+
+// Interns the builtins so that builtins[i] is ATOM i.
+// Must run before anything else is interned; createInterpreter() calls it first thing.
+void internBuiltins() {
+    for (ATOM i = 0; i < NUM_BUILTINS; ++i) {
+        if (intern(builtins[i].name, strlen(builtins[i].name)) != i)
+            yyerror("internBuiltins() must run before anything else is interned");
     }
-    return CUSTOM_OPER;
 }
 
-char *typeNames[] = {
-        "int",
-        "double",
-        ""
-};
+// Returns a new interpreter reading read's input from in and writing its output to out.
+CILISP *createInterpreter(FILE *in, FILE *out) {
+    CILISP *interpreter;
+    if ((interpreter = calloc(1, sizeof(CILISP))) == NULL) {
+        yyerror("Memory allocation failed!");
+        return NULL;
+    }
 
-NUM_TYPE resolveType(char *typeName) {
-    int i = 0;
-    while (typeNames[i][0] != '\0') {
-        if (strcmp(typeNames[i], typeName) == 0)
-            return i;
-        ++i;
+    interpreter->in = in;
+    interpreter->out = out;
+    // the state drand48() starts from, so every interpreter draws the same sequence as an unseeded one would
+    interpreter->seed[0] = 0x330e;
+    interpreter->seed[1] = 0xabcd;
+    interpreter->seed[2] = 0x1234;
+
+    if (yylex_init_extra(interpreter, &interpreter->scanner) != 0) {
+        yyerror("Memory allocation failed!");
+        free(interpreter);
+        return NULL;
     }
+
+    CILISP *caller = cilisp;
+    cilisp = interpreter;
+    internBuiltins();
+    cilisp = caller;
+
+    return interpreter;
+}
+
+// Frees interpreter and everything it holds. It must not be running.
+void freeInterpreter(CILISP *interpreter) {
+    if (!interpreter)
+        return;
+
+    yylex_destroy(interpreter->scanner);
+    freeAtoms(&interpreter->atoms);
+    freeArena(&interpreter->arena);
+    freeVM(interpreter->vm);
+    free(interpreter);
+}
+
+// Returns the token for the word atom: FUNC, TYPE or a keyword for a builtin, otherwise SYMBOL.
+int builtinToken(ATOM atom) {
+    return atom >= 0 && atom < NUM_BUILTINS ? builtins[atom].token : SYMBOL;
+}
+
+OPER_TYPE resolveFunc(ATOM funcName) {
+    if (builtinToken(funcName) == FUNC)
+        return builtins[funcName].value;
+    return CUSTOM_OPER;
+}
+
+NUM_TYPE resolveType(ATOM typeName) {
+    if (builtinToken(typeName) == TYPE)
+        return builtins[typeName].value;
     return NO_TYPE;
 }
 
@@ -69,20 +132,19 @@ NUM_TYPE resolveType(char *typeName) {
 // Called when an INT or DOUBLE token is encountered (see ciLisp.l and ciLisp.y).
 // Creates an AST_NODE for the number.
 // Sets the AST_NODE's type to number.
-// Populates the value of the contained NUMBER_AST_NODE with the argument value.
+// Populates the contained NUMBER_AST_NODE with the argument number.
 // SEE: AST_NODE, NUM_AST_NODE, AST_NODE_TYPE.
-AST_NODE *createNumberNode(double value, NUM_TYPE type) {
+AST_NODE *createNumberNode(NUM_AST_NODE number) {
     AST_NODE *node;
     size_t nodeSize;
 
-    // allocate space for the fixed sie and the variable part (union)
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    // allocate space for the fixed size and the number's part of the union from the arena
+    nodeSize = AST_NODE_SIZE(number);
+    if ((node = arenaAlloc(nodeSize)) == NULL)
         yyerror("Memory allocation failed!");
 
     node->type = NUM_NODE_TYPE;
-    node->data.number.value = value;
-    node->data.number.type = type;
+    node->data.number = number;
 
     return node;
 }
@@ -94,51 +156,27 @@ AST_NODE *createNumberNode(double value, NUM_TYPE type) {
 //      - An OPER_TYPE (the enum identifying the specific function being called)
 //      - 2 AST_NODEs, the operands
 // SEE: AST_NODE, FUNC_AST_NODE, AST_NODE_TYPE.
-AST_NODE *createFunctionNode(char *funcName, AST_NODE *opList) {
+AST_NODE *createFunctionNode(ATOM funcName, AST_NODE *opList) {
     AST_NODE *node;
     size_t nodeSize;
 
     // allocate space (or error)
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    nodeSize = AST_NODE_SIZE(function);
+    if ((node = arenaAlloc(nodeSize)) == NULL)
         yyerror("Memory allocation failed!");
 
-    // NOTE: you do not need to populate the "ident" field unless the function is type CUSTOM_OPER.
-    // When you do have a CUSTOM_OPER, you do NOT need to allocate and strcpy here.
-    // The funcName will be a string identifier for which space should be allocated in the tokenizer.
-    // For CUSTOM_OPER functions, you should simply assign the "ident" pointer to the passed in funcName.
-    // For functions other than CUSTOM_OPER, you should free the funcName after you're assigned the OPER_TYPE.
+    // NOTE: the "ident" field is only used if the function is type CUSTOM_OPER.
+    // funcName is an interned ATOM (see ciLispAtoms.h), so there is nothing to allocate or free here.
 
     node->type = FUNC_NODE_TYPE;
-    node->symbolTable = NULL;
     node->data.function.oper = resolveFunc(funcName);
 
 
-    if(node->data.function.oper <= RAND_OPER) {
-        if (!checkParamList(funcName, 0, opList)) {
-            return NULL;
-        }
-    }else if(node->data.function.oper <= CBRT_OPER){
-        if(!checkParamList(funcName, 1, opList)){
-            return NULL;
-        }
-    }else if (node->data.function.oper <= GREATER_OPER){
-        if(!checkParamList(funcName, 2, opList)){
-            return NULL;
-        }    }
-
-    if (node->data.function.oper == CUSTOM_OPER)
-        node->data.function.ident = funcName;
-    else
-        free(funcName);
-
-    AST_NODE *tempNode = opList;
-
-    while(tempNode){
-        tempNode->parent = node;
-        tempNode = tempNode->next;
-    }
+    int arity = operArity(node->data.function.oper);
+    if (arity >= 0 && !checkParamList(atomName(funcName), arity, opList))
+        return NULL;
 
+    node->data.function.ident = funcName;
     node->data.function.opList = opList;
 
     return node;
@@ -146,16 +184,12 @@ AST_NODE *createFunctionNode(char *funcName, AST_NODE *opList) {
 
 AST_NODE *createCondNode(AST_NODE *condition, AST_NODE *ifTrue, AST_NODE *ifFalse){
     AST_NODE *node;
-    size_t nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    size_t nodeSize = AST_NODE_SIZE(condition);
+    if ((node = arenaAlloc(nodeSize)) == NULL)
         yyerror("Memory allocation failed!");
 
     node->type = COND_NODE_TYPE;
 
-    condition->parent = node;
-    ifTrue->parent = node;
-    ifFalse->parent = node;
-
     node->data.condition.cond = condition;
     node->data.condition.ifTrue = ifTrue;
     node->data.condition.ifFalse = ifFalse;
@@ -163,6 +197,18 @@ AST_NODE *createCondNode(AST_NODE *condition, AST_NODE *ifTrue, AST_NODE *ifFals
     return node;
 }
 
+// Number of operands a builtin takes, or -1 if it takes any number of them.
+// Relies on the nonary/unary/binary grouping of OPER_TYPE.
+int operArity(OPER_TYPE oper) {
+    if (oper <= RAND_OPER)
+        return 0;
+    if (oper <= CBRT_OPER)
+        return 1;
+    if (oper <= GREATER_OPER)
+        return 2;
+    return -1;
+}
+
 //Checks the number of operands in opList matches numOps.
 // Returns true if there are enough operands, otherwise throws an error and returns false.
 //  If there are too many operands, returns true but prints an error.
@@ -170,32 +216,40 @@ bool checkParamList(char *funcName, int numOps, AST_NODE *opList){
         AST_NODE *temp = opList;
         for (int i = 0; i < numOps; ++i){
             if(!temp) {
-                printf("ERROR: too few parameters for the function <%s>\n", funcName);
+                fprintf(cilisp->out, "ERROR: too few parameters for the function <%s>\n", funcName);
                 return false;
             }
             temp = temp->next;
         }
         if(temp)
-            printf("WARNING: too many parameters for the function <%s>\n", funcName);
+            fprintf(cilisp->out, "WARNING: too many parameters for the function <%s>\n", funcName);
         return true;
 }
 
-AST_NODE *createSymbolNode(char *ident) {
+AST_NODE *createSymbolNode(ATOM ident) {
     AST_NODE *node;
-    size_t nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    size_t nodeSize = AST_NODE_SIZE(symbol);
+    if ((node = arenaAlloc(nodeSize)) == NULL)
         yyerror("Memory allocation failed!");
 
     node->type = SYMBOL_NODE_TYPE;
-//    node->parent = NULL;
     node->data.symbol.ident = ident;
 
     return node;
 }
 
-AST_NODE *addSymbolTable(TABLE_NODE *symbolTable, AST_NODE *node) {
-    node->symbolTable = symbolTable;
-//    node->symbolTable->val->parent = node;
+// Creates the node for a let section and the expression (body) it is attached to.
+// The let values and lambda bodies see the whole let section, the same way body does.
+AST_NODE *createLetNode(TABLE_NODE *symbolTable, AST_NODE *body) {
+    AST_NODE *node;
+    size_t nodeSize = AST_NODE_SIZE(let);
+    if ((node = arenaAlloc(nodeSize)) == NULL)
+        yyerror("Memory allocation failed!");
+
+    node->type = LET_NODE_TYPE;
+    node->data.let.symbolTable = symbolTable;
+    node->data.let.body = body;
+
     return node;
 }
 
@@ -204,31 +258,27 @@ AST_NODE *addAstNode(AST_NODE *parent, AST_NODE *child){
     return parent;
 }
 
-TABLE_NODE *createSymbolTableNode(char *ident, AST_NODE *valueNode, NUM_TYPE type) {
+TABLE_NODE *createSymbolTableNode(ATOM ident, AST_NODE *valueNode, NUM_TYPE type) {
     //TODO createSymbolNode
     TABLE_NODE *node;
     size_t nodeSize = sizeof(TABLE_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    if ((node = arenaAlloc(nodeSize)) == NULL)
         yyerror("Memory allocation failed!");
 
     node->nodeType = SYMBOL_TABLE_NODE_TYPE;
     node->ident = ident;
-    if(valueNode->type == FUNC_NODE_TYPE && valueNode->data.function.oper <= RAND_OPER){
-        RET_VAL temp = eval(valueNode);
-        node->data.symbol.val = createNumberNode(temp.value, temp.type);
-    }else {
-        node->data.symbol.val = valueNode;
-    }
+    // read and rand values are evaluated when the let section is entered, see createLetScope()
+    node->data.symbol.val = valueNode;
     node->type = type;
     node->next = NULL;
 
     return node;
 }
 
-TABLE_NODE *createArgNode(char *ident, TABLE_NODE *next){
+TABLE_NODE *createArgNode(ATOM ident, TABLE_NODE *next){
     TABLE_NODE *node;
     size_t nodeSize = sizeof(TABLE_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    if ((node = arenaAlloc(nodeSize)) == NULL)
         yyerror("Memory allocation failed!");
 
     node->nodeType = SYMBOL_TABLE_NODE_TYPE;
@@ -242,323 +292,164 @@ TABLE_NODE *createArgNode(char *ident, TABLE_NODE *next){
     return node;
 }
 
-TABLE_NODE *createFuncTableNode(char *ident, AST_NODE *customOper, NUM_TYPE type, TABLE_NODE *argList){
+TABLE_NODE *createFuncTableNode(ATOM ident, AST_NODE *customOper, NUM_TYPE type, TABLE_NODE *argList){
     TABLE_NODE *node;
     size_t nodeSize = sizeof(TABLE_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    if ((node = arenaAlloc(nodeSize)) == NULL)
         yyerror("Memory allocation failed!");
 
     node->nodeType = FUNC_TABLE_NODE_TYPE;
     node->ident = ident;
     node->type = type;
 
-//    node->data.function.argList = argList;
-
-    customOper->symbolTable = argList;
+    node->data.function.argList = argList;
     node->data.function.customOper = customOper;
 
-
     node->next = NULL;
 
     return node;
 }
 
+// Appends newNode to the let section starting at parentNode.
+// Identifiers are ATOMs, so a second definition of the same symbol is caught by comparing them;
+// it is reported and left out of the table (the first definition wins, as it would in lookups).
 TABLE_NODE *addToTable(TABLE_NODE *parentNode, TABLE_NODE *newNode) {
 
     if (parentNode->ident == newNode->ident) {
-        yyerror("Conflicting Symbol Definition");
+        fprintf(cilisp->out, "ERROR: conflicting definitions of <%s>\n", atomName(newNode->ident));
+        return NULL;
     }
 
     while (parentNode->next != NULL) {
         parentNode = parentNode->next;
         if (parentNode->ident == newNode->ident) {
-            yyerror("Conflicting Symbol Definition");
+            fprintf(cilisp->out, "ERROR: conflicting definitions of <%s>\n", atomName(newNode->ident));
+            return NULL;
         }
     }
     parentNode->next = newNode;
 
+    return newNode;
 }
 
 
 
-// Called after execution is done on the base of the tree.
-// (see the program production in ciLisp.y)
-// Recursively frees the whole abstract syntax tree.
-// You'll need to update and expand freeNode as the project develops.
-void freeNode(AST_NODE *node) {
-    if (!node)
-        return;
-
-    switch(node->type){
-        case FUNC_NODE_TYPE:
-            // Recursive calls to free child nodes
-            freeNode(node->data.function.opList);
-
-            // Free up identifier string if necessary
-            if (node->data.function.oper == CUSTOM_OPER) {
-                free(node->data.function.ident);
-            }
-            break;
-        case SYMBOL_NODE_TYPE:
-            free(node->data.symbol.ident);
-            break;
-        case COND_NODE_TYPE:
-            freeNode(node->data.condition.cond);
-            freeNode(node->data.condition.ifTrue);
-            freeNode(node->data.condition.ifFalse);
-            break;
-        case NUM_NODE_TYPE:
-            break;
+// Looks ident up in scopes, innermost first.
+// Returns the matching TABLE_NODE and sets depth and slot, or returns NULL if there is none.
+TABLE_NODE *resolveIdent(const RESOLVE_SCOPE *scopes, ATOM ident, int *depth, int *slot) {
+    for (*depth = 0; scopes; scopes = scopes->parent, ++*depth) {
+        *slot = 0;
+        for (TABLE_NODE *temp = scopes->symbolTable; temp; temp = temp->next, ++*slot) {
+            if (temp->ident == ident)
+                return temp;
+        }
     }
-
-    free(node);
+    return NULL;
 }
 
-// Evaluates an AST_NODE.
-// returns a RET_VAL storing the the resulting value and type.
-// You'll need to update and expand eval (and the more specific eval functions below)
-// as the project develops.
-RET_VAL eval(AST_NODE *node) {
+static bool resolveNode(AST_NODE *node, const RESOLVE_SCOPE *scopes, bool checkCalls) {
     if (!node)
-        return (RET_VAL) {INT_TYPE, NAN};
+        return true;
 
-    RET_VAL result = {INT_TYPE, NAN}; // see NUM_AST_NODE, because RET_VAL is just an alternative name for it.
+    bool resolved = true;
+    TABLE_NODE *tableNode;
+    RESOLVE_SCOPE inner;
 
-    // Make calls to other eval functions based on node type.
-    // Use the results of those calls to populate result.
     switch (node->type) {
-        case NUM_NODE_TYPE:
-            result = evalNumNode(node);
+        case LET_NODE_TYPE:
+            // let values and lambda bodies see the whole let section, lambda bodies their arguments too
+            inner = (RESOLVE_SCOPE) {node->data.let.symbolTable, scopes};
+            for (tableNode = node->data.let.symbolTable; tableNode; tableNode = tableNode->next) {
+                if (tableNode->nodeType == FUNC_TABLE_NODE_TYPE) {
+                    RESOLVE_SCOPE args = {tableNode->data.function.argList, &inner};
+                    resolved = resolveNode(tableNode->data.function.customOper, &args, checkCalls) && resolved;
+                } else {
+                    resolved = resolveNode(tableNode->data.symbol.val, &inner, checkCalls) && resolved;
+                }
+            }
+            resolved = resolveNode(node->data.let.body, &inner, checkCalls) && resolved;
             break;
         case FUNC_NODE_TYPE:
-            result = evalFuncNode(node);
+            if (node->data.function.oper == CUSTOM_OPER) {
+                tableNode = resolveIdent(scopes, node->data.function.ident,
+                                         &node->data.function.depth, &node->data.function.slot);
+                if (!tableNode || tableNode->nodeType != FUNC_TABLE_NODE_TYPE) {
+                    fprintf(cilisp->out, "ERROR: undefined function <%s>\n", atomName(node->data.function.ident));
+                    resolved = false;
+                } else if (checkCalls) {
+                    // checked here once, like the builtins' in createFunctionNode(), rather than on every call
+                    int numArgs = 0;
+                    for (TABLE_NODE *arg = tableNode->data.function.argList; arg; arg = arg->next)
+                        numArgs++;
+                    if (!checkParamList(atomName(node->data.function.ident), numArgs, node->data.function.opList))
+                        resolved = false;
+                }
+            }
+            for (AST_NODE *op = node->data.function.opList; op; op = op->next)
+                resolved = resolveNode(op, scopes, checkCalls) && resolved;
+            break;
+        case SYMBOL_NODE_TYPE:
+            if (!resolveIdent(scopes, node->data.symbol.ident, &node->data.symbol.depth, &node->data.symbol.slot)) {
+                fprintf(cilisp->out, "ERROR: undefined symbol <%s>\n", atomName(node->data.symbol.ident));
+                resolved = false;
+            }
             break;
         case COND_NODE_TYPE:
-            result = evalCondNode(node);
+            resolved = resolveNode(node->data.condition.cond, scopes, checkCalls) && resolved;
+            resolved = resolveNode(node->data.condition.ifTrue, scopes, checkCalls) && resolved;
+            resolved = resolveNode(node->data.condition.ifFalse, scopes, checkCalls) && resolved;
             break;
-        case SYMBOL_NODE_TYPE:
-            result = evalSymbolNode(node);
+        case NUM_NODE_TYPE:
             break;
-        default:
-            yyerror("Invalid AST_NODE_TYPE, probably invalid writes somewhere!");
     }
 
-    return result;
+    return resolved;
 }
 
-// returns a pointer to the NUM_AST_NODE (aka RET_VAL) referenced by node.
-// DOES NOT allocate space for a new RET_VAL.
-RET_VAL evalNumNode(AST_NODE *node) {
-    if (!node)
-        return (RET_VAL) {INT_TYPE, NAN};
-
-    RET_VAL result = {INT_TYPE, NAN};
-
-    // SEE: AST_NODE, AST_NODE_TYPE, NUM_AST_NODE
-
-    result.value = node->data.number.value;
-    result.type = node->data.number.type;
-
-    return result;
+// Called on each top level expression before it is evaluated (see the program production in ciLisp.y).
+// Resolves every symbol and custom function reference to the (depth, slot) of its definition,
+// so evaluation never has to search the symbol tables by name.
+// Prints an error for each undefined reference and each custom function call with too few operands,
+// and returns false if there were any.
+bool resolve(AST_NODE *node) {
+    return resolveNode(node, NULL, true);
 }
 
+// Resolves the references in a tree that has been through resolve() again, after optimize() changed it.
+// The custom function calls were checked (and warned about) the first time, so they aren't again.
+void resolveAgain(AST_NODE *node) {
+    resolveNode(node, NULL, false);
+}
 
-RET_VAL evalFuncNode(AST_NODE *node) {
-    if (!node)
-        return (RET_VAL) {INT_TYPE, NAN};
-
-    RET_VAL result = {INT_TYPE, NAN};
-
-    AST_NODE *tempNode = node->data.function.opList;
-
-    while(tempNode){
-        if(tempNode->type != NO_TYPE)
-            result.type = result.type || eval(tempNode).type;
-        tempNode = tempNode->next;
-    }
-
-
-    // TODO     evalFuncNode:             populate result with the result of running the function on its operands.
-    // SEE: AST_NODE, AST_NODE_TYPE, FUNC_AST_NODE
-
-    tempNode = node->data.function.opList;
-
-    double temp;
-
-    switch (node->data.function.oper) {
-        case READ_OPER:
-            result = myRead();
-//            node = createNumberNode(result.value, result.type); //Convert node to Number Node to prevent reassigning value
-            break;
-        case RAND_OPER:
-            result = myRand();
-//            node = createNumberNode(result.value, result.type); //Convert node to Number Node to prevent reassigning value
-            break;
-
-        case NEG_OPER:
-            result.value = -1 * eval(tempNode).value;
-            break;
-        case ABS_OPER:
-            result.value = fabs(eval(tempNode).value);
-            break;
-        case EXP_OPER:
-            result.value = exp(eval(tempNode).value);
-            result.type = DOUBLE_TYPE;
-            break;
-        case SQRT_OPER:
-            result.value = sqrt(eval(tempNode).value);
-            result.type = DOUBLE_TYPE;
-            break;
-        case LOG_OPER:
-            result.value = log(eval(tempNode).value);
-            result.type = DOUBLE_TYPE;
-            break;
-        case EXP2_OPER:
-            temp = eval(tempNode).value;
-            result.value = exp2(temp);
-            if(temp < 0)
-                result.type = DOUBLE_TYPE;
-            break;
-        case CBRT_OPER:
-            result.value = cbrt(eval(tempNode).value);
-            result.type = DOUBLE_TYPE;
-            break;
-
-        case REMAINDER_OPER:
-            result.value = remainder(eval(tempNode).value, eval(tempNode->next).value);
-            break;
-        case POW_OPER:
-            result.value = pow(eval(tempNode).value, eval(tempNode->next).value);
-            break;
-        case MAX_OPER:
-            result.value = fmax(eval(tempNode).value, eval(tempNode->next).value);
-            break;
-        case MIN_OPER:
-            result.value = fmin(eval(tempNode).value, eval(tempNode->next).value);
-            break;
-        case HYPOT_OPER:
-            result.value = hypot(eval(tempNode).value, eval(tempNode->next).value);
-            result.type = DOUBLE_TYPE;
-            break;
-
-        case EQUAL_OPER:
-            result.value = eval(tempNode).value == eval(tempNode->next).value;
-            break;
-        case LESS_OPER:
-            result.value = eval(tempNode).value < eval(tempNode->next).value;
-            break;
-        case GREATER_OPER:
-            result.value = eval(tempNode).value > eval(tempNode->next).value;
-            break;
-
+// True for a value that is a read or rand call.
+// Such values are evaluated as soon as they are bound, exactly once, even if they are never used,
+// so input is read and random numbers are drawn in the order the bindings are written.
+bool isEagerValue(AST_NODE *valueNode) {
+    return valueNode->type == FUNC_NODE_TYPE && valueNode->data.function.oper <= RAND_OPER;
+}
 
-        case PRINT_OPER:
-            result = print(node->data.function.opList);
-            printf("\n");
-            break;
+// Applies the pure builtin oper to the numbers in ops, with the VM's typing rules and arithmetic,
+// for the optimizer's constant folding. Programs themselves are run by the VM (see compile() and run()).
+// ops holds the builtin's operands up to its arity (see operArity()).
+RET_VAL evalBuiltin(OPER_TYPE oper, RET_VAL *ops, int numOps) {
+    switch (oper) {
         case ADD_OPER:
-            result = addOper(node->data.function.opList);
-            break;
+            return addOper(ops, numOps);
         case SUB_OPER:
-            result = subOper(node->data.function.opList);
-            break;
+            return subOper(ops, numOps);
         case MULT_OPER:
-            result = multOper(node->data.function.opList);
-            break;
+            return multOper(ops, numOps);
         case DIV_OPER:
-            result = divOper(node->data.function.opList);
-            break;
-
-        case CUSTOM_OPER:
-            result = evalCustomFunc(node, node->data.function.opList);
-            break;
-
-    }
-
-
-    if (result.type == INT_TYPE)
-        result.value = floor(result.value);
-
-    return result;
-}
-
-RET_VAL evalCustomFunc(AST_NODE *symbolNode, AST_NODE *opList){
-    RET_VAL result = (RET_VAL){NO_TYPE, NAN};
-//    RET_VAL result = (RET_VAL){INT_TYPE, 69};
-
-    TABLE_NODE *node = getSymbolTableNode(symbolNode);
-
-    if(node->nodeType != FUNC_TABLE_NODE_TYPE){
-        yyerror("ERROR: Invalid nodeType in evalCustomFunc");
-    }
-
-    AST_NODE *func = node->data.function.customOper;
-
-//    AST_NODE *op = opList;
-//    TABLE_NODE *arg = func->symbolTable;
-    TABLE_NODE *arg = createArgOpList(func->symbolTable, opList);
-
-    TABLE_NODE *originalSymbolTable = func->symbolTable;
-    func->symbolTable = arg;
-    result = eval(func);
-    func->symbolTable = originalSymbolTable;
-//    freeSymbolTable(arg);
-
-    return result;
-}
-
-TABLE_NODE *createArgOpList(TABLE_NODE *args, AST_NODE *opList){
-    TABLE_NODE *tempArg = args;
-    AST_NODE *tempOp = opList;
-
-    TABLE_NODE *result = createSymbolTableNode(tempArg->ident, tempOp, tempArg->type);
-    TABLE_NODE *tempResult = result;
-    tempArg = tempArg->next;
-    tempOp = tempOp->next;
-
-
-    while (tempArg && tempOp) {
-        tempResult->next = createSymbolTableNode(tempArg->ident, tempOp, tempArg->type);
-        tempResult = tempResult->next;
-        tempArg = tempArg->next;
-        tempOp = tempOp->next;
-    }
-
-    if(tempArg){
-        printf("ERROR: too few parameters for the custom function");
-    }else if (tempOp){
-        printf("WARNING: too many parameters for the custom function");
-    }
-
-    return result;
-}
-
-void freeSymbolTable(TABLE_NODE *symbolTable){
-    TABLE_NODE *temp = symbolTable;
-    TABLE_NODE *tempNext = temp->next;
-
-    while (temp){
-        free(temp);
-        temp = tempNext;
-//        if(temp->next)
-        tempNext = temp->next;
-    }
-}
-
-RET_VAL evalCondNode(AST_NODE *node){
-    RET_VAL result;
-
-    if(eval(node->data.condition.cond).value == 0){
-        result = eval(node->data.condition.ifFalse);
-    }else{
-        result = eval(node->data.condition.ifTrue);
+            return divOper(ops, numOps);
+        default:
+            // the unary builtins come before the binary ones, see OPER_TYPE
+            return oper <= CBRT_OPER ? unaryOper(oper, ops[0]) : binaryOper(oper, ops[0], ops[1]);
     }
-
-    return result;
 }
 
 RET_VAL myRead(){
-    RET_VAL result = (RET_VAL){INT_TYPE, NAN};
+    RET_VAL result;
+    NUM_TYPE type = INT_TYPE;
 
     size_t BUFFER_SIZE = 128;
     size_t lineSize;
@@ -566,24 +457,24 @@ RET_VAL myRead(){
     if ((buffer = calloc(BUFFER_SIZE, 1)) == NULL)
         yyerror("Memory allocation failed!");
 
-    printf("read := ");
+    fprintf(cilisp->out, "read := ");
 
-    lineSize = getline(&buffer, &BUFFER_SIZE, stdin);
+    lineSize = getline(&buffer, &BUFFER_SIZE, cilisp->in);
 
     char c = buffer[0];
 
     for(int i = 0; i < lineSize && c != '\n'; ++i ){
         if((c < '0' || c > '9') && c != '.'){
-            printf("ERROR: Invalid number, try again.");
+            fprintf(cilisp->out, "ERROR: Invalid number, try again.");
             free(buffer);
             return myRead();
         }
         if(c == '.'){
-            result.type = DOUBLE_TYPE;
+            type = DOUBLE_TYPE;
             c = buffer[i + 1];
             for(++i; i < lineSize && c != '\n'; ++i){
                 if(( c < '0' || c > '9') ){
-                    printf("ERROR: Invalid number, try again.\n");
+                    fprintf(cilisp->out, "ERROR: Invalid number, try again.\n");
                     free(buffer);
                     return myRead();
                 }
@@ -594,7 +485,10 @@ RET_VAL myRead(){
     }
 
     char *endOfValue;
-    result.value = strtod(buffer, &endOfValue);
+    if (type == INT_TYPE)
+        result = intValue(strtoll(buffer, &endOfValue, 10));
+    else
+        result = doubleValue(strtod(buffer, &endOfValue));
 
     //Determines the type based on the value rather than the format
 //    if(remainder(temp, 1) == 0 ){
@@ -607,228 +501,263 @@ RET_VAL myRead(){
 }
 
 RET_VAL myRand(){
-    double temp = (double) rand() / RAND_MAX;
+    // each interpreter has its own generator, so draws on one thread don't change another's sequence
+    double temp = erand48(cilisp->seed);
 
-    RET_VAL result = (RET_VAL){DOUBLE_TYPE, temp};
+    RET_VAL result = doubleValue(temp);
 
     return result;
 }
 
-RET_VAL addOper(AST_NODE *op){
-    if(!op)
-        return  (RET_VAL){INT_TYPE, NAN};
-    RET_VAL result = (RET_VAL){INT_TYPE, 0};
+RET_VAL boxInt(int64_t value) {
+    int64_t *box;
+    if ((box = arenaAlloc(sizeof(int64_t))) == NULL)
+        yyerror("Memory allocation failed!");
 
-    while(op){
-        RET_VAL temp = eval(op);
-        result.value += temp.value;
-        result.type |= temp.type;
-        op = op->next;
-    }
+    *box = value;
+    return boxedInt(box);
+}
 
-    return result;
+// The INT_TYPE number floor(value), or NO_INT if that doesn't fit in an int64_t (or value is NAN).
+RET_VAL floorToInt(double value) {
+    value = floor(value);
+    if (!(value >= -0x1p63 && value < 0x1p63))
+        return intValue(NO_INT);
+    return intValue((int64_t) value);
 }
 
-RET_VAL subOper(AST_NODE *op){
-    if(!op)
-        return  (RET_VAL){INT_TYPE, NAN};
-    RET_VAL result = eval(op);
-    op = op->next;
+// remainder() on integers: a - n * b for the integer n nearest a / b, ties to even.
+static RET_VAL intRemainder(int64_t a, int64_t b) {
+    if (b == 0)
+        return intValue(NO_INT);
+    if (b == -1) // INT64_MIN % -1 overflows
+        return intValue(0);
 
-    while(op){
-        RET_VAL temp = eval(op);
-        result.value -= temp.value;
-        result.type |= temp.type;
-        op = op->next;
-    }
+    int64_t q = a / b, r = a % b;
+    uint64_t absR = r < 0 ? -(uint64_t) r : (uint64_t) r;
+    uint64_t absB = b < 0 ? -(uint64_t) b : (uint64_t) b;
+    if (2 * absR > absB || (2 * absR == absB && (q & 1)))
+        r = (int64_t) ((uint64_t) r + (a < 0 ? absB : -absB));
 
-    return result;
+    return intValue(r);
 }
 
-RET_VAL multOper(AST_NODE *op){
-    if(!op)
-        return  (RET_VAL){INT_TYPE, NAN};
-    RET_VAL result = eval(op);
-    op = op->next;
+// pow() on integers, exact as long as the result fits in an int64_t.
+static RET_VAL intPow(int64_t base, int64_t exponent) {
+    if (exponent < 0)
+        return floorToInt(pow(base, exponent));
 
-    while(op){
-        RET_VAL temp = eval(op);
-        result.value *= temp.value;
-        result.type |= temp.type;
-        op = op->next;
+    int64_t result = 1, power = base;
+    for (int64_t e = exponent; e; e >>= 1) {
+        // power is only squared when it will be multiplied in, so it overflows only if the result does
+        if (((e & 1) && __builtin_mul_overflow(result, power, &result))
+            || (e > 1 && __builtin_mul_overflow(power, power, &power)))
+            return floorToInt(pow(base, exponent));
     }
 
-    return result;
+    return intValue(result);
 }
 
-RET_VAL divOper(AST_NODE *op){
-    if(!op)
-        return  (RET_VAL){INT_TYPE, NAN};
-    RET_VAL result = eval(op);
-    op = op->next;
-
-    while(op){
-        RET_VAL temp = eval(op);
-        result.value /= temp.value;
-        result.type |= temp.type;
-        op = op->next;
+// The unary builtins.
+RET_VAL unaryOper(OPER_TYPE oper, RET_VAL a) {
+    switch (oper) {
+        case NEG_OPER:
+            if (numType(a) == INT_TYPE)
+                return intValue(hasInt(a) ? -intOf(a) : NO_INT);
+            return doubleValue(-1 * numValue(a));
+        case ABS_OPER:
+            if (numType(a) == INT_TYPE)
+                return intValue(hasInt(a) && intOf(a) < 0 ? -intOf(a) : intOf(a));
+            return doubleValue(fabs(numValue(a)));
+        case EXP_OPER:
+            return doubleValue(exp(numValue(a)));
+        case SQRT_OPER:
+            return doubleValue(sqrt(numValue(a)));
+        case LOG_OPER:
+            return doubleValue(log(numValue(a)));
+        case EXP2_OPER:
+            if (!hasInt(a))
+                return numType(a) == INT_TYPE ? a : doubleValue(exp2(numValue(a)));
+            if (intOf(a) < 0)
+                return doubleValue(exp2(intOf(a)));
+            return intValue(intOf(a) < 63 ? (int64_t) 1 << intOf(a) : NO_INT);
+        case CBRT_OPER:
+            return doubleValue(cbrt(numValue(a)));
+        default:
+            return intValue(NO_INT);
     }
-
-    return result;
 }
 
-RET_VAL print(AST_NODE *node){
-    RET_VAL result = (RET_VAL){NO_TYPE, NAN};
-    if(!node)
-        return result;
-
-    printf("=> ");
-
-    AST_NODE *temp = node;
-    while(temp) {
-
-        result = eval(temp);
-        switch (result.type) {
-            case INT_TYPE:
-                printf("Integer: %ld ", (long) floor(result.value));
-                break;
-            case DOUBLE_TYPE:
-                printf("Double: %f ", result.value);
-                break;
+// The binary builtins. The result is an INT_TYPE if both operands are, except for hypot.
+RET_VAL binaryOper(OPER_TYPE oper, RET_VAL a, RET_VAL b) {
+    double x = numValue(a), y = numValue(b);
+
+    if (hasInt(a) && hasInt(b)) {
+        int64_t i = intOf(a), j = intOf(b);
+        switch (oper) {
+            case REMAINDER_OPER:
+                return intRemainder(i, j);
+            case POW_OPER:
+                return intPow(i, j);
+            case MAX_OPER:
+                return intValue(i > j ? i : j);
+            case MIN_OPER:
+                return intValue(i < j ? i : j);
+            case EQUAL_OPER:
+                return intValue(i == j);
+            case LESS_OPER:
+                return intValue(i < j);
+            case GREATER_OPER:
+                return intValue(i > j);
             default:
-                yyerror("Invalid Type Error in print\n");
                 break;
         }
-        temp = temp->next;
     }
-    return result;
-}
-
-RET_VAL printVerbose(AST_NODE *node) {
-    if (!node) return (RET_VAL) {NO_TYPE, NAN};
 
-    RET_VAL result = eval(node);
-
-
-    switch (node->type) {
-        case NUM_NODE_TYPE:
-            switch (result.type) {
-                case INT_TYPE:
-                    printf("(INT_TYPE: %ld) ", (long) floor(result.value));
-                    break;
-                case DOUBLE_TYPE:
-                    printf("(DOUBLE_TYPE: %f) ", result.value);
-                    break;
-                default:
-                    yyerror("Invalid Type Error in printRetVal");
-                    break;
-            }
+    // a DOUBLE_TYPE operand, or an INT_TYPE one that is NO_INT: the double result is floored
+    // back to an INT_TYPE when neither operand is a DOUBLE_TYPE, as it used to be
+    double result;
+    switch (oper) {
+        case REMAINDER_OPER:
+            result = remainder(x, y);
             break;
-        case FUNC_NODE_TYPE:
-            printf("(FUNC: %s ", funcNames[node->data.function.oper]);
-            AST_NODE *temp = node->data.function.opList;
-            while(temp){
-                print(temp);
-                temp = temp->next;
-            }
-            printf(") ");
+        case POW_OPER:
+            result = pow(x, y);
             break;
-        case COND_NODE_TYPE:
-            printf("(COND: [UNFINISHED] ");
+        case MAX_OPER:
+            result = fmax(x, y);
             break;
-        case SYMBOL_NODE_TYPE:
-            printf("(SYMBOL: %s ", node->data.symbol.ident);
-            print(getSymbolTableNode(node)->data.symbol.val);
-            printf(") ");
+        case MIN_OPER:
+            result = fmin(x, y);
+            break;
+        case HYPOT_OPER:
+            return doubleValue(hypot(x, y));
+        case EQUAL_OPER:
+            result = x == y;
+            break;
+        case LESS_OPER:
+            result = x < y;
+            break;
+        case GREATER_OPER:
+            result = x > y;
             break;
+        default:
+            return intValue(NO_INT);
     }
-    return result;
-}
 
-RET_VAL evalSymbolNode(AST_NODE *symbolNode) {
-    //TODO evalSymbolNode
-
-    if (!symbolNode)
-        return (RET_VAL) {INT_TYPE, NAN};
-
-    RET_VAL result = {INT_TYPE, NAN};
+    return numType(a) == INT_TYPE && numType(b) == INT_TYPE ? floorToInt(result) : doubleValue(result);
+}
 
-    TABLE_NODE *tempTableNode = getSymbolTableNode(symbolNode);
+// The arithmetic of addOper() to divOper() on the operands as doubles: a DOUBLE_TYPE result if any
+// operand is not an INT_TYPE, otherwise the INT_TYPE floor of the result.
+// Used for mixed operands, NO_INT operands, and integer results that don't fit in an int64_t.
+static RET_VAL doubleOper(OPER_TYPE oper, RET_VAL *ops, int numOps) {
+    double result = numValue(ops[0]);
+    NUM_TYPE type = INT_TYPE;
+    int i;
 
+    for (i = 0; i < numOps; ++i) {
+        if (numType(ops[i]) != INT_TYPE)
+            type = DOUBLE_TYPE;
+    }
 
-    switch (tempTableNode->nodeType){
-        case SYMBOL_TABLE_NODE_TYPE:
-            result = eval(tempTableNode->data.symbol.val);
+    switch (oper) {
+        case ADD_OPER:
+            for (result = 0, i = 0; i < numOps; ++i)
+                result += numValue(ops[i]);
             break;
-        case FUNC_TABLE_NODE_TYPE:
-
+        case SUB_OPER:
+            for (i = 1; i < numOps; ++i)
+                result -= numValue(ops[i]);
+            break;
+        case MULT_OPER:
+            for (i = 1; i < numOps; ++i)
+                result *= numValue(ops[i]);
             break;
         default:
-            yyerror("ERROR: Invalid TABLE_NODE_TYPE in evalSymbolNode");
+            for (i = 1; i < numOps; ++i)
+                result /= numValue(ops[i]);
             break;
-
     }
 
-    if(tempTableNode->nodeType == SYMBOL_TABLE_NODE_TYPE) {
-        result = eval(tempTableNode->data.symbol.val);
-    }
+    return type == INT_TYPE ? floorToInt(result) : doubleValue(result);
+}
 
-    if (result.type == DOUBLE_TYPE && tempTableNode->type == INT_TYPE) {
-        printf("WARNING: precision loss in the assignment for variable %s\n", symbolNode->data.symbol.ident);
-        result.value = round(result.value);
+RET_VAL addOper(RET_VAL *ops, int numOps){
+    if(numOps == 0)
+        return intValue(NO_INT);
+
+    int64_t result = 0;
+    for(int i = 0; i < numOps; ++i){
+        if (!hasInt(ops[i]) || __builtin_add_overflow(result, intOf(ops[i]), &result))
+            return doubleOper(ADD_OPER, ops, numOps);
     }
 
-    return result;
+    return intValue(result);
 }
 
-TABLE_NODE *getSymbolTableNode(AST_NODE *symbolNode) {
-    //TODO evalSymbolNode
+RET_VAL subOper(RET_VAL *ops, int numOps){
+    if(numOps == 0)
+        return intValue(NO_INT);
+    if (!hasInt(ops[0]))
+        return doubleOper(SUB_OPER, ops, numOps);
 
-    char *ident;
-
-    if(symbolNode->type == SYMBOL_NODE_TYPE){
-        ident = symbolNode->data.symbol.ident;
-    } else if (symbolNode->type == FUNC_NODE_TYPE){
-        ident = symbolNode->data.function.ident;
-    }else{
-        yyerror("ERROR: Invalid AST_NODE_TYPE in getSymbolTableNode");
+    int64_t result = intOf(ops[0]);
+    for(int i = 1; i < numOps; ++i){
+        if (!hasInt(ops[i]) || __builtin_sub_overflow(result, intOf(ops[i]), &result))
+            return doubleOper(SUB_OPER, ops, numOps);
     }
 
-//    TABLE_NODE *result = symbolNode->symbolTable;
-    TABLE_NODE *result = NULL;
-    AST_NODE *tempNode = symbolNode;
-    bool found = false;
-
-//    while (!found && tempNode->parent != NULL) {
-    while (!found && tempNode != NULL) {
+    return intValue(result);
+}
 
-//        tempNode = tempNode->parent;
-        result = tempNode->symbolTable;
+RET_VAL multOper(RET_VAL *ops, int numOps){
+    if(numOps == 0)
+        return intValue(NO_INT);
+    if (!hasInt(ops[0]))
+        return doubleOper(MULT_OPER, ops, numOps);
 
-        while (!found && result != NULL) {
-            if (strcmp(ident, result->ident) == 0)
-                found = true;
-            else
-                result = result->next;
-        }
-        tempNode = tempNode->parent;
+    int64_t result = intOf(ops[0]);
+    for(int i = 1; i < numOps; ++i){
+        if (!hasInt(ops[i]) || __builtin_mul_overflow(result, intOf(ops[i]), &result))
+            return doubleOper(MULT_OPER, ops, numOps);
     }
 
-    if (!found) {
-        yyerror("Invalid Symbol");
+    return intValue(result);
+}
+
+// Integer division floors the quotient of all the operands once, as dividing the doubles and flooring did:
+// a / b / c is a / (b * c), rounded down.
+RET_VAL divOper(RET_VAL *ops, int numOps){
+    if(numOps == 0)
+        return intValue(NO_INT);
+    if (!hasInt(ops[0]))
+        return doubleOper(DIV_OPER, ops, numOps);
+
+    int64_t divisor = 1;
+    for(int i = 1; i < numOps; ++i){
+        if (!hasInt(ops[i]) || __builtin_mul_overflow(divisor, intOf(ops[i]), &divisor))
+            return doubleOper(DIV_OPER, ops, numOps);
     }
+    int64_t dividend = intOf(ops[0]);
+    if (divisor == 0 || (dividend == INT64_MIN && divisor == -1))
+        return doubleOper(DIV_OPER, ops, numOps);
 
-    return result;
+    int64_t result = dividend / divisor;
+    if (dividend % divisor != 0 && (dividend < 0) != (divisor < 0))
+        result--;
+
+    return intValue(result);
 }
 
 // prints the type and value of a RET_VAL
 void printRetVal(RET_VAL val) {
-    switch (val.type) {
+    switch (numType(val)) {
         case INT_TYPE:
-            printf("Integer: %ld", (long) floor(val.value));
+            fprintf(cilisp->out, "Integer: %ld", (long) intOf(val));
             break;
         case DOUBLE_TYPE:
-            printf("Double: %f", val.value);
+            fprintf(cilisp->out, "Double: %f", doubleOf(val));
             break;
         default:
             yyerror("Invalid Type Error in printRetVal");
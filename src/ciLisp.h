@@ -1,23 +1,76 @@
 #ifndef __cilisp_h_
 #define __cilisp_h_
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "ciLispParser.h"
-
-int yyparse(void);
-
-int yylex(void);
+#include "ciLispAtoms.h"
+#include "ciLispArena.h"
+
+typedef struct vm VM;
+
+// One interpreter: its scanner, and all the state the scanner, the parser and the evaluator work on.
+// Any number of them can exist at once, each used by one thread at a time.
+// Everything below the parser reaches the one it is working for through cilisp, which runFile() and runLine() set.
+typedef struct cilisp {
+    yyscan_t scanner;
+    bool batchMode;         // running a file rather than a line typed at the prompt
+    int parenDepth;         // the scanner's, see ciLisp.l
+    bool endedLastForm;
+    bool quit;              // set by quit, which stops the interpreter instead of the process
+
+    ATOM_TABLE atoms;
+    ARENA arena;            // the AST_NODEs of the top level expression being run, and the frame stack
+    VM *vm;                 // run()'s value and call stacks, see ciLispVM.c
+    unsigned short seed[3]; // rand's, see myRand()
+
+    FILE *in;               // read's input
+    FILE *out;              // results, print's output and error messages
+} CILISP;
+
+// The interpreter running on this thread.
+extern _Thread_local CILISP *cilisp;
+
+CILISP *createInterpreter(FILE *in, FILE *out);
+void freeInterpreter(CILISP *interpreter);
+bool runFile(CILISP *interpreter, char *path, bool stream);
+void runLine(CILISP *interpreter, const char *line);
+
+// The scanner is reentrant (see ciLisp.l) and the parser pure (see ciLisp.y); these are flex's.
+int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+int yylex_init_extra(CILISP *interpreter, yyscan_t *scanner);
+int yylex_destroy(yyscan_t scanner);
 
 void yyerror(char *);
 
+// Trace output on stderr from the scanner, the parser and the evaluator.
+// It is only compiled in when CILISP_TRACE is defined (cmake -DCILISP_TRACE=ON); otherwise TRACE()
+// expands to nothing and its arguments are never evaluated. When compiled in, traceLevel (set from the
+// CILISP_TRACE_LEVEL environment variable in main()) picks how much of it is printed.
+typedef enum {
+    TRACE_NONE,
+    TRACE_STATS,   // arena and optimizer statistics for each top level expression
+    TRACE_PARSER,  // parser reductions
+    TRACE_SCANNER  // tokens
+} TRACE_LEVEL;
+
+#ifdef CILISP_TRACE
+extern TRACE_LEVEL traceLevel;
+#define TRACE(level, ...) do { if (traceLevel >= (level)) fprintf(stderr, __VA_ARGS__); } while (0)
+#else
+#define TRACE(level, ...) ((void) 0)
+#endif
+
 // Enum of all operators.
-// must be in sync with funcs in resolveFunc()
+// must be in sync with builtins[] in ciLisp.c
 typedef enum oper {
     READ_OPER, // 0
     RAND_OPER,
@@ -51,7 +104,9 @@ typedef enum oper {
     CUSTOM_OPER =255
 } OPER_TYPE;
 
-OPER_TYPE resolveFunc(char *);
+void internBuiltins();
+int builtinToken(ATOM atom);
+OPER_TYPE resolveFunc(ATOM funcName);
 
 // Types of Abstract Syntax Tree nodes.
 // Initially, there are only numbers and functions.
@@ -60,7 +115,8 @@ typedef enum {
     NUM_NODE_TYPE,
     FUNC_NODE_TYPE,
     SYMBOL_NODE_TYPE,
-    COND_NODE_TYPE
+    COND_NODE_TYPE,
+    LET_NODE_TYPE
 } AST_NODE_TYPE;
 
 // Types of numeric values
@@ -70,16 +126,116 @@ typedef enum {
     NO_TYPE
 } NUM_TYPE;
 
-NUM_TYPE resolveType(char*);
+NUM_TYPE resolveType(ATOM typeName);
 
-// Node to store a number.
+// Node to store a number, NaN-boxed in one 64 bit word so it is passed around in a single register.
+// A DOUBLE_TYPE number is the bits of its double. The other types use NaN bit patterns that arithmetic
+// never produces (the NaNs it makes have bit 50, the one after the quiet bit, clear):
+//   0x7ffc... | payload: an INT_TYPE number that fits in the 50 bit payload, sign extended
+//   0xfffc... | payload: an INT_TYPE number that doesn't, the payload pointing at its int64_t (see boxedInt())
+//   0xfffc000000000000:  NO_TYPE (a null pointer)
+//   0xfffc000000000001:  NO_INT (see below)
+// Only use the inline functions below to make and take apart numbers.
 typedef struct {
-    NUM_TYPE type;
-    double value;
+    uint64_t bits;
 } NUM_AST_NODE;
 
+#define BOX_BITS 0x7ffc000000000000ull
+#define BOX_PAYLOAD 0x0003ffffffffffffull
+#define BOX_INT_MIN (-((int64_t) 1 << 49))
+#define BOX_INT_MAX (((int64_t) 1 << 49) - 1)
+#define NO_TYPE_BITS 0xfffc000000000000ull
+#define NO_INT_BITS 0xfffc000000000001ull
+
+// The INT_TYPE result of integer arithmetic with no int64_t value (a division by zero, an overflow,
+// a missing operand). It is what such results floored to when integers were held as doubles, and prints the same.
+// Like the NAN it stands for, it carries through any arithmetic it is an operand of.
+#define NO_INT INT64_MIN
+
+// The INT_TYPE number whose int64_t is *box.
+// The pointer has to fit in the 50 bit payload. User space addresses do on x86-64 and AArch64,
+// where Linux keeps them below 2^47 (2^48) unless a program asks mmap() for higher ones.
+static inline NUM_AST_NODE boxedInt(int64_t *box) {
+    assert(((uintptr_t) box & ~BOX_PAYLOAD) == 0);
+    return (NUM_AST_NODE) {NO_TYPE_BITS | (uintptr_t) box};
+}
+
+// Boxes an INT_TYPE value outside [BOX_INT_MIN, BOX_INT_MAX], see intValue().
+// The int64_t lives in the arena, so the number is good until the end of the top level expression.
+// The VM keeps the ones it makes in boxes of its own instead, see reboxInt().
+NUM_AST_NODE boxInt(int64_t value);
+
+static inline NUM_AST_NODE intValue(int64_t value) {
+    if (value < BOX_INT_MIN || value > BOX_INT_MAX)
+        return value == NO_INT ? (NUM_AST_NODE) {NO_INT_BITS} : boxInt(value);
+    return (NUM_AST_NODE) {BOX_BITS | ((uint64_t) value & BOX_PAYLOAD)};
+}
+
+// True if num is an INT_TYPE number kept in a box.
+static inline bool isBoxedInt(NUM_AST_NODE num) {
+    return num.bits >> 50 == NO_TYPE_BITS >> 50 && num.bits != NO_TYPE_BITS && num.bits != NO_INT_BITS;
+}
+
+// num, with its int64_t copied into *box if it is a boxed integer.
+static inline NUM_AST_NODE reboxInt(NUM_AST_NODE num, int64_t *box) {
+    if (!isBoxedInt(num))
+        return num;
+    *box = *(int64_t *) (uintptr_t) (num.bits & BOX_PAYLOAD);
+    return boxedInt(box);
+}
+
+static inline NUM_AST_NODE doubleValue(double value) {
+    union { double value; uint64_t bits; } number = {value};
+    return (NUM_AST_NODE) {number.bits};
+}
+
+static inline NUM_AST_NODE noValue() {
+    return (NUM_AST_NODE) {NO_TYPE_BITS};
+}
+
+static inline NUM_TYPE numType(NUM_AST_NODE num) {
+    if ((num.bits & BOX_BITS) != BOX_BITS)
+        return DOUBLE_TYPE;
+    return num.bits == NO_TYPE_BITS ? NO_TYPE : INT_TYPE;
+}
+
+// The value of an INT_TYPE number.
+static inline int64_t intOf(NUM_AST_NODE num) {
+    if (num.bits >> 63)
+        return num.bits == NO_INT_BITS ? NO_INT : *(int64_t *) (uintptr_t) (num.bits & BOX_PAYLOAD);
+    return (int64_t) (num.bits << 14) >> 14;
+}
+
+// The value of a DOUBLE_TYPE number.
+static inline double doubleOf(NUM_AST_NODE num) {
+    union { uint64_t bits; double value; } number = {num.bits};
+    return number.value;
+}
+
+// True if num is an INT_TYPE number the integer arithmetic can work on.
+static inline bool hasInt(NUM_AST_NODE num) {
+    // integers that fit in the payload first, they are by far the most common
+    return num.bits >> 50 == BOX_BITS >> 50 || (numType(num) == INT_TYPE && num.bits != NO_INT_BITS);
+}
+
+// A number's value as a double, whatever its type.
+static inline double numValue(NUM_AST_NODE num) {
+    switch (numType(num)) {
+        case DOUBLE_TYPE:
+            return doubleOf(num);
+        case INT_TYPE:
+            return num.bits == NO_INT_BITS ? NAN : (double) intOf(num);
+        default:
+            return NAN;
+    }
+}
+
+// depth and slot are filled in by resolve():
+// the symbol is entry number slot of the depth'th let section or arg_list enclosing the node.
 typedef struct symbol_ast_node {
-    char *ident;
+    ATOM ident;
+    int depth;
+    int slot;
 } SYMBOL_AST_NODE;
 
 typedef struct {
@@ -96,7 +252,9 @@ typedef NUM_AST_NODE RET_VAL;
 // Node to store a function call with its inputs
 typedef struct {
     OPER_TYPE oper;
-    char* ident; // only needed for custom functions
+    ATOM ident; // only needed for custom functions
+    int depth; // custom functions only, see SYMBOL_AST_NODE
+    int slot;
     struct ast_node *opList;
 } FUNC_AST_NODE;
 
@@ -111,9 +269,8 @@ typedef enum {
 //} ARG_NODE;
 
 typedef struct {
-//    struct table_node *argList;
-    struct ast_node *customOper;
-
+    struct table_node *argList;
+    struct ast_node *customOper; // the lambda's body
 } FUNC_TABLE_NODE;
 
 typedef struct{
@@ -122,7 +279,7 @@ typedef struct{
 
 typedef struct table_node {
     TABLE_NODE_TYPE nodeType;
-    char *ident;
+    ATOM ident;
     NUM_TYPE type;
 
     union {
@@ -130,57 +287,80 @@ typedef struct table_node {
         FUNC_TABLE_NODE function;
     } data;
 
+    bool used; // set by optimize() when code that can run refers to the entry
+
+    // set by inferTypes(): the static type of the value or the lambda's result, NO_TYPE if it is only known at run time
+    NUM_TYPE valueType;
+    bool inferred;
+
     struct table_node *next;
 } TABLE_NODE;
 
+// A let section and the expression it is attached to.
+typedef struct {
+    TABLE_NODE *symbolTable;
+    struct ast_node *body;
+} LET_AST_NODE;
+
 // Generic Abstract Syntax Tree node. Stores the type of node,
 // and reference to the corresponding specific node (initially a number or function call).
+// data must stay last: nodes are allocated with only as much of the union as their type uses (see AST_NODE_SIZE).
 typedef struct ast_node {
     AST_NODE_TYPE type;
-    TABLE_NODE *symbolTable;
-    struct ast_node *parent;
+    NUM_TYPE valueType;    // set by inferTypes(), see TABLE_NODE
+    struct ast_node *next; // next operand in a FUNC_AST_NODE's opList
     union {
         NUM_AST_NODE number;
         FUNC_AST_NODE function;
         COND_AST_NODE condition;
         SYMBOL_AST_NODE symbol;
+        LET_AST_NODE let;
     } data;
-    struct ast_node *next;
 } AST_NODE;
 
-AST_NODE *createNumberNode(double value, NUM_TYPE type);
-AST_NODE *createSymbolNode(char *ident);
-AST_NODE *createFunctionNode(char *funcName, AST_NODE *opList);
+#define AST_NODE_SIZE(member) (offsetof(AST_NODE, data) + sizeof(((AST_NODE *) NULL)->data.member))
+
+// Custom function arguments are evaluated once, in the caller's scope, when the function is called.
+// Building with CALL_BY_NAME defined (cmake -DCILISP_CALL_BY_NAME=ON) binds each argument to its operand instead,
+// which is then evaluated every time the argument is used.
+
+AST_NODE *createNumberNode(NUM_AST_NODE number);
+AST_NODE *createSymbolNode(ATOM ident);
+AST_NODE *createFunctionNode(ATOM funcName, AST_NODE *opList);
 AST_NODE *createCondNode(AST_NODE *condition, AST_NODE *ifTrue, AST_NODE *ifFalse);
+int operArity(OPER_TYPE oper);
 bool checkParamList(char *funcName, int numOps, AST_NODE *opList);
 AST_NODE *addAstNode(AST_NODE *parent, AST_NODE *child);
 
-AST_NODE *addSymbolTable(TABLE_NODE *symbolTable, AST_NODE *node);
-TABLE_NODE *createSymbolTableNode(char *ident, AST_NODE *valueNode, NUM_TYPE type);
-TABLE_NODE *createArgNode(char *ident, TABLE_NODE *next);
-TABLE_NODE *createFuncTableNode(char *ident, AST_NODE *customOper, NUM_TYPE type, TABLE_NODE *argList);
+AST_NODE *createLetNode(TABLE_NODE *symbolTable, AST_NODE *body);
+TABLE_NODE *createSymbolTableNode(ATOM ident, AST_NODE *valueNode, NUM_TYPE type);
+TABLE_NODE *createArgNode(ATOM ident, TABLE_NODE *next);
+TABLE_NODE *createFuncTableNode(ATOM ident, AST_NODE *customOper, NUM_TYPE type, TABLE_NODE *argList);
 TABLE_NODE *addToTable(TABLE_NODE *headNode, TABLE_NODE *newNode);
 
-void freeNode(AST_NODE *node);
+// The let sections and arg_lists enclosing a node while resolve() (or an optimizer pass) walks down to it,
+// innermost first. They live on the C stack, one per let section or lambda body being walked.
+typedef struct resolve_scope {
+    TABLE_NODE *symbolTable;
+    const struct resolve_scope *parent;
+} RESOLVE_SCOPE;
 
-RET_VAL eval(AST_NODE *node);
-RET_VAL evalNumNode(AST_NODE *node);
-RET_VAL evalFuncNode(AST_NODE *node);
-RET_VAL evalCustomFunc(AST_NODE *symboNode, AST_NODE *opList);
-RET_VAL evalCondNode(AST_NODE *node);
+TABLE_NODE *resolveIdent(const RESOLVE_SCOPE *scopes, ATOM ident, int *depth, int *slot);
+bool resolve(AST_NODE *node);
+void resolveAgain(AST_NODE *node);
 
-TABLE_NODE *createArgOpList(TABLE_NODE *args, AST_NODE *opList);
+bool isEagerValue(AST_NODE *valueNode);
 
 RET_VAL myRead();
 RET_VAL myRand();
-RET_VAL addOper(AST_NODE *op);
-RET_VAL subOper(AST_NODE *op);
-RET_VAL multOper(AST_NODE *op);
-RET_VAL divOper(AST_NODE *op);
-RET_VAL print(AST_NODE *node);
-RET_VAL evalSymbolNode(AST_NODE *node);
-TABLE_NODE *getSymbolTableNode(AST_NODE *symbolNode);
-void freeSymbolTable(TABLE_NODE *symbolTable);
+RET_VAL floorToInt(double value);
+RET_VAL unaryOper(OPER_TYPE oper, RET_VAL a);
+RET_VAL binaryOper(OPER_TYPE oper, RET_VAL a, RET_VAL b);
+RET_VAL addOper(RET_VAL *ops, int numOps);
+RET_VAL subOper(RET_VAL *ops, int numOps);
+RET_VAL multOper(RET_VAL *ops, int numOps);
+RET_VAL divOper(RET_VAL *ops, int numOps);
+RET_VAL evalBuiltin(OPER_TYPE oper, RET_VAL *ops, int numOps);
 
 
 
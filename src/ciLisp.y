@@ -1,92 +1,133 @@
+%code requires {
+    // the reentrant scanner's handle (see ciLisp.l), declared the way flex declares it
+    #ifndef YY_TYPEDEF_YY_SCANNER_T
+    #define YY_TYPEDEF_YY_SCANNER_T
+    typedef void *yyscan_t;
+    #endif
+}
+
 %{
     #include "ciLisp.h"
+    #include "ciLispOptimizer.h"
+    #include "ciLispTypes.h"
+    #include "ciLispVM.h"
+
+    // a pure parser hands yyerror() the scanner it was given as well, which error messages don't need
+    #define yyerror(scanner, message) yyerror(message)
 %}
 
+%define api.pure full
+%param {yyscan_t scanner}
+
 %union {
     double dval;
-    char *sval;
+    int64_t lval;
+    int ival;
+    int atom;
     struct ast_node *astNode;
     struct table_node *tableNode;
 };
 
-%token <sval> FUNC SYMBOL TYPE
-%token <dval> INT DOUBLE
+%token <atom> FUNC SYMBOL TYPE
+%token <lval> INT
+%token <dval> DOUBLE
 %token LPAREN RPAREN LET COND LAMBDA EOL QUIT
 
-%type <astNode> s_expr s_expr_list f_expr number type
+%type <astNode> s_expr s_expr_list f_expr number
+%type <ival> type
 %type <tableNode> let_list let_section let_elem arg_list
 
 %%
 
 program:
+    %empty
+    | program form;
+
+form:
     s_expr EOL {
-        fprintf(stderr, "yacc: program ::= s_expr EOL\n");
-        if ($1) {
-            printRetVal(eval($1));
-            freeNode($1);
+        TRACE(TRACE_PARSER, "yacc: form ::= s_expr EOL\n");
+        if ($1 && resolve($1)) {
+            AST_NODE *node = optimize($1);
+            TRACE(TRACE_STATS, "optimizer: %d inlined, %d propagated, %d folded, %d pruned, %d dropped, %d shared\n",
+                  optimizerStats().inlined, optimizerStats().propagated, optimizerStats().folded,
+                  optimizerStats().pruned, optimizerStats().dropped, optimizerStats().shared);
+            inferTypes(node);
+            TRACE(TRACE_STATS, "types: %d of %d nodes typed\n", typeStats().typed, typeStats().nodes);
+            BYTECODE *program = compile(node);
+            printRetVal(run(program));
+            freeBytecode(program);
+            if (cilisp->batchMode)
+                fprintf(cilisp->out, "\n");
         }
+        TRACE(TRACE_STATS, "arena: %zu nodes, %zu bytes, high water %zu of %zu bytes\n",
+              arenaStats().nodes, arenaStats().bytes, arenaStats().highWater, arenaStats().capacity);
+        arenaReset();
+    }
+    | EOL {
+        TRACE(TRACE_PARSER, "yacc: form ::= EOL\n");
     };
 
 s_expr:
     number {
-        fprintf(stderr, "yacc: s_expr ::= number\n");
+        TRACE(TRACE_PARSER, "yacc: s_expr ::= number\n");
         $$ = $1;
     }
     | f_expr {
         $$ = $1;
     }
     | LPAREN let_section s_expr RPAREN{
-    	fprintf(stderr, "yacc: s_expr ::= LPAREN let_section s_expr RPAREN\n");
-    	$$ = addSymbolTable($2, $3);
+    	TRACE(TRACE_PARSER, "yacc: s_expr ::= LPAREN let_section s_expr RPAREN\n");
+    	$$ = createLetNode($2, $3);
     }
     | LPAREN COND s_expr s_expr s_expr RPAREN{
     	$$ = createCondNode($3, $4, $5);
     }
     | SYMBOL {
-    	fprintf(stderr, "yacc: s_expr ::= symbol\n");
+    	TRACE(TRACE_PARSER, "yacc: s_expr ::= symbol\n");
     	$$ = createSymbolNode($1);
     }
     | QUIT {
-        fprintf(stderr, "yacc: s_expr ::= QUIT\n");
-        exit(EXIT_SUCCESS);
+        TRACE(TRACE_PARSER, "yacc: s_expr ::= QUIT\n");
+        cilisp->quit = true;
+        YYACCEPT;
     }
     | error {
-        fprintf(stderr, "yacc: s_expr ::= error\n");
-        yyerror("unexpected token");
+        TRACE(TRACE_PARSER, "yacc: s_expr ::= error\n");
+        yyerror(scanner, "unexpected token");
         $$ = NULL;
     };
 
 s_expr_list:
 	s_expr s_expr_list {
-		fprintf(stderr, "yacc: s_expr_list ::= s_expr s_expr_list\n");
+		TRACE(TRACE_PARSER, "yacc: s_expr_list ::= s_expr s_expr_list\n");
 		$$ = addAstNode($1, $2);
 	}
 	| s_expr{
-		fprintf(stderr, "yacc: s_expr_list ::= s_expr\n");
+		TRACE(TRACE_PARSER, "yacc: s_expr_list ::= s_expr\n");
 		$$ = $1;
 	}
 
 number:
     INT {
-        fprintf(stderr, "yacc: number ::= INT\n");
-        $$ = createNumberNode($1, INT_TYPE);
+        TRACE(TRACE_PARSER, "yacc: number ::= INT\n");
+        $$ = createNumberNode(intValue($1));
     }
     | DOUBLE {
-        fprintf(stderr, "yacc: number ::= DOUBLE\n");
-        $$ = createNumberNode($1, DOUBLE_TYPE);
+        TRACE(TRACE_PARSER, "yacc: number ::= DOUBLE\n");
+        $$ = createNumberNode(doubleValue($1));
     };
 
 f_expr:
     LPAREN FUNC s_expr_list RPAREN {
-        fprintf(stderr, "yacc: s_expr ::= LPAREN FUNC expr RPAREN\n");
+        TRACE(TRACE_PARSER, "yacc: s_expr ::= LPAREN FUNC expr RPAREN\n");
         $$ = createFunctionNode($2, $3);
     }
     | LPAREN FUNC RPAREN {
-        fprintf(stderr, "yacc: s_expr ::= LPAREN FUNC expr RPAREN\n");
+        TRACE(TRACE_PARSER, "yacc: s_expr ::= LPAREN FUNC expr RPAREN\n");
         $$ = createFunctionNode($2, NULL);
     }
     | LPAREN SYMBOL s_expr_list RPAREN {
-        fprintf(stderr, "yacc: s_expr ::= LPAREN FUNC expr RPAREN\n");
+        TRACE(TRACE_PARSER, "yacc: s_expr ::= LPAREN FUNC expr RPAREN\n");
 //        AST_NODE *temp = createFunctionNode($2, $3);
 //        TABLE_NODE *tempSymbolTableNode = createSymbolTableNode($2, NULL,
 //        $$ = createFunctionNode(createSymbolNode($2), $3);
@@ -100,34 +141,34 @@ f_expr:
 
 let_section:
 	LPAREN let_list RPAREN {
-        	fprintf(stderr, "yacc: let_section ::= LPAREN let_list RPAREN\n");
+        	TRACE(TRACE_PARSER, "yacc: let_section ::= LPAREN let_list RPAREN\n");
 		$$ = $2;
 	};
 let_list:
 	LET let_elem {
-        	fprintf(stderr, "yacc: let_list ::= let let_elem\n");
-		$$ = $2
+        	TRACE(TRACE_PARSER, "yacc: let_list ::= let let_elem\n");
+		$$ = $2;
 	}
 	| let_list let_elem {
-        	fprintf(stderr, "yacc: let_list ::= let_list let_elem\n");
+        	TRACE(TRACE_PARSER, "yacc: let_list ::= let_list let_elem\n");
         	addToTable($1, $2);
 		$$ = $1;
 	};
 let_elem:
 	LPAREN SYMBOL s_expr RPAREN {
-		fprintf(stderr, "yacc: let_elem ::= LPAREN SYMBOL s_expr RPAREN\n");
+		TRACE(TRACE_PARSER, "yacc: let_elem ::= LPAREN SYMBOL s_expr RPAREN\n");
 		$$ = createSymbolTableNode($2, $3, NO_TYPE);
 	}
 	| LPAREN type SYMBOL s_expr RPAREN {
-		fprintf(stderr, "yacc: let_elem ::= LPAREN type SYMBOL s_expr RPAREN\n");
+		TRACE(TRACE_PARSER, "yacc: let_elem ::= LPAREN type SYMBOL s_expr RPAREN\n");
 		$$ = createSymbolTableNode($3, $4, $2);
 	};
 	| LPAREN type SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN{
-		fprintf(stderr, "yacc: let_elem ::= LPAREN type SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+		TRACE(TRACE_PARSER, "yacc: let_elem ::= LPAREN type SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
 		$$ = createFuncTableNode($3, $8, $2, $6);
 	};
 	| LPAREN SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN{
-		fprintf(stderr, "yacc: let_elem ::= LPAREN SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+		TRACE(TRACE_PARSER, "yacc: let_elem ::= LPAREN SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
 		$$ = createFuncTableNode($2, $7, NO_TYPE, $5);
 	};
 
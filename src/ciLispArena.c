@@ -0,0 +1,185 @@
+#include "ciLisp.h"
+
+// Size of the first block, enough for a few thousand nodes.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+// Enough for the doubles and pointers nodes and frames hold.
+#define ARENA_ALIGN 8
+
+// Blocks are chained newest first. Normally there is only one; a line that outgrows it
+// gets more, and the next reset replaces them with a single block big enough for all of them.
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+} ARENA_BLOCK;
+
+static ARENA_BLOCK *createBlock(ARENA *arena, size_t size, ARENA_BLOCK *next) {
+    ARENA_BLOCK *block;
+    if ((block = malloc(sizeof(ARENA_BLOCK) + size)) == NULL)
+        return NULL;
+
+    block->next = next;
+    block->size = size;
+    block->used = 0;
+    arena->stats.capacity += size;
+
+    return block;
+}
+
+// Returns size zeroed bytes from the arena, or NULL if no memory is left.
+void *arenaAlloc(size_t size) {
+    ARENA *arena = &cilisp->arena;
+    ARENA_BLOCK *blocks = arena->blocks;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    if (!blocks || blocks->used + size > blocks->size) {
+        size_t blockSize = blocks ? 2 * blocks->size : ARENA_BLOCK_SIZE;
+        if (blockSize < size)
+            blockSize = size;
+
+        ARENA_BLOCK *block = createBlock(arena, blockSize, blocks);
+        if (!block)
+            return NULL;
+        arena->blocks = blocks = block;
+    }
+
+    void *result = blocks->data + blocks->used;
+    blocks->used += size;
+    memset(result, 0, size);
+
+    arena->stats.bytes += size;
+    arena->stats.nodes++;
+    if (arena->stats.bytes > arena->stats.highWater)
+        arena->stats.highWater = arena->stats.bytes;
+
+    return result;
+}
+
+// Releases everything allocated since the last reset.
+void arenaReset() {
+    ARENA *arena = &cilisp->arena;
+    ARENA_BLOCK *blocks = arena->blocks;
+    if (blocks && blocks->next) {
+        size_t size = 0;
+        while (blocks) {
+            ARENA_BLOCK *next = blocks->next;
+            size += blocks->size;
+            free(blocks);
+            blocks = next;
+        }
+        arena->stats.capacity = 0;
+        arena->blocks = createBlock(arena, size, NULL);
+    } else if (blocks) {
+        blocks->used = 0;
+    }
+
+    arena->stats.bytes = 0;
+    arena->stats.nodes = 0;
+}
+
+ARENA_MARK arenaMark() {
+    ARENA *arena = &cilisp->arena;
+    return (ARENA_MARK) {arena->blocks, arena->blocks ? arena->blocks->used : 0, arena->stats.bytes, arena->stats.nodes};
+}
+
+// Releases everything allocated since mark was taken, including the blocks added since.
+void arenaRelease(ARENA_MARK mark) {
+    ARENA *arena = &cilisp->arena;
+    while (arena->blocks != mark.block) {
+        ARENA_BLOCK *next = arena->blocks->next;
+        arena->stats.capacity -= arena->blocks->size;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    if (arena->blocks)
+        arena->blocks->used = mark.used;
+
+    arena->stats.bytes = mark.bytes;
+    arena->stats.nodes = mark.nodes;
+}
+
+ARENA_STATS arenaStats() {
+    return cilisp->arena.stats;
+}
+
+// Size of the first frame block, enough for a few thousand nested calls.
+#define FRAME_BLOCK_SIZE (64 * 1024)
+
+// Frame blocks are chained in both directions: frameBlock is the one frames are pushed on,
+// the blocks after it are empty and kept for reuse.
+typedef struct frame_block {
+    struct frame_block *prev;
+    struct frame_block *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+} FRAME_BLOCK;
+
+// Returns size bytes on top of the frame stack, or NULL if no memory is left.
+// The memory is not cleared.
+void *framePush(size_t size) {
+    FRAME_BLOCK *frameBlock = cilisp->arena.frameBlock;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    if (!frameBlock || frameBlock->used + size > frameBlock->size) {
+        FRAME_BLOCK *block = frameBlock ? frameBlock->next : NULL;
+
+        if (!block || block->size < size) {
+            size_t blockSize = frameBlock ? 2 * frameBlock->size : FRAME_BLOCK_SIZE;
+            if (blockSize < size)
+                blockSize = size;
+
+            if ((block = malloc(sizeof(FRAME_BLOCK) + blockSize)) == NULL)
+                return NULL;
+            block->size = blockSize;
+            block->prev = frameBlock;
+            block->next = frameBlock ? frameBlock->next : NULL;
+            if (block->next)
+                block->next->prev = block;
+            if (frameBlock)
+                frameBlock->next = block;
+        }
+
+        block->used = 0;
+        cilisp->arena.frameBlock = frameBlock = block;
+    }
+
+    void *result = frameBlock->data + frameBlock->used;
+    frameBlock->used += size;
+
+    return result;
+}
+
+// Pops frame, and every frame pushed after it, off the frame stack.
+void framePop(void *frame) {
+    FRAME_BLOCK *frameBlock = cilisp->arena.frameBlock;
+    char *top = frame;
+
+    while (top < frameBlock->data || top >= frameBlock->data + frameBlock->size) {
+        frameBlock->used = 0;
+        frameBlock = frameBlock->prev;
+    }
+    frameBlock->used = top - frameBlock->data;
+    cilisp->arena.frameBlock = frameBlock;
+}
+
+// Frees every block of arena, which must not be used again.
+void freeArena(ARENA *arena) {
+    while (arena->blocks) {
+        ARENA_BLOCK *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+
+    // the current frame block may have empty ones both before and after it
+    FRAME_BLOCK *block = arena->frameBlock;
+    while (block && block->prev)
+        block = block->prev;
+    while (block) {
+        FRAME_BLOCK *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->frameBlock = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef __cilisp_arena_h_
+#define __cilisp_arena_h_
+
+#include <stddef.h>
+
+// Bump pointer allocator for the AST_NODEs and TABLE_NODEs of one top level expression.
+// Everything allocated while a line is parsed and evaluated is released at once by arenaReset()
+// at the end of the program production (see ciLisp.y).
+typedef struct {
+    size_t bytes;      // bytes handed out since the last reset
+    size_t nodes;      // allocations since the last reset
+    size_t highWater;  // most bytes in use at once since the interpreter started
+    size_t capacity;   // bytes currently reserved by the arena
+} ARENA_STATS;
+
+// One interpreter's arena and frame stack (see CILISP); the functions below work on the current interpreter's.
+typedef struct {
+    struct arena_block *blocks;
+    ARENA_STATS stats;
+    struct frame_block *frameBlock;
+} ARENA;
+
+// A point in the arena to go back to with arenaRelease().
+typedef struct {
+    struct arena_block *block;
+    size_t used;
+    size_t bytes;
+    size_t nodes;
+} ARENA_MARK;
+
+void *arenaAlloc(size_t size);
+void arenaReset();
+ARENA_MARK arenaMark();
+void arenaRelease(ARENA_MARK mark);
+ARENA_STATS arenaStats();
+void freeArena(ARENA *arena);
+
+// Last in, first out allocator for the scopes of custom function calls and let sections
+// created during evaluation. Its blocks are kept and reused, so once it has grown to the
+// deepest nesting seen, pushing and popping frames never touches the heap.
+// Frames don't move once pushed, so pointers into them stay valid until they are popped.
+void *framePush(size_t size);
+void framePop(void *frame);
+
+#endif
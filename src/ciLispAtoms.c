@@ -0,0 +1,95 @@
+#include "ciLisp.h"
+
+// FNV-1a
+static size_t hashName(const char *name, size_t length) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void growBuckets(ATOM_TABLE *atoms) {
+    size_t i;
+
+    free(atoms->buckets);
+    atoms->numBuckets = atoms->numBuckets ? 2 * atoms->numBuckets : 256;
+    if ((atoms->buckets = malloc(atoms->numBuckets * sizeof(ATOM))) == NULL)
+        yyerror("Memory allocation failed!");
+
+    for (i = 0; i < atoms->numBuckets; ++i)
+        atoms->buckets[i] = -1;
+
+    for (ATOM atom = 0; atom < atoms->numAtoms; ++atom) {
+        i = hashName(atoms->names[atom], atoms->lengths[atom]) & (atoms->numBuckets - 1);
+        while (atoms->buckets[i] != -1)
+            i = (i + 1) & (atoms->numBuckets - 1);
+        atoms->buckets[i] = atom;
+    }
+}
+
+// Returns the bucket holding the ATOM for name, or the empty bucket it would go in.
+static size_t findBucket(const ATOM_TABLE *atoms, const char *name, size_t length) {
+    size_t i = hashName(name, length) & (atoms->numBuckets - 1);
+    while (atoms->buckets[i] != -1) {
+        ATOM atom = atoms->buckets[i];
+        if (atoms->lengths[atom] == length && memcmp(atoms->names[atom], name, length) == 0)
+            break;
+        i = (i + 1) & (atoms->numBuckets - 1);
+    }
+    return i;
+}
+
+// Returns the ATOM for the first length characters of name, adding it on first sight.
+// name does not need to be null terminated (the scanner passes yytext and yyleng).
+ATOM intern(const char *name, size_t length) {
+    ATOM_TABLE *atoms = &cilisp->atoms;
+    if (2 * (size_t) atoms->numAtoms >= atoms->numBuckets)
+        growBuckets(atoms);
+
+    size_t i = findBucket(atoms, name, length);
+    if (atoms->buckets[i] != -1)
+        return atoms->buckets[i];
+
+    if (atoms->numAtoms == atoms->capacity) {
+        atoms->capacity = atoms->capacity ? 2 * atoms->capacity : 128;
+        if ((atoms->names = realloc(atoms->names, atoms->capacity * sizeof(char *))) == NULL
+            || (atoms->lengths = realloc(atoms->lengths, atoms->capacity * sizeof(size_t))) == NULL)
+            yyerror("Memory allocation failed!");
+    }
+
+    char *copy;
+    if ((copy = malloc(length + 1)) == NULL)
+        yyerror("Memory allocation failed!");
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    atoms->names[atoms->numAtoms] = copy;
+    atoms->lengths[atoms->numAtoms] = length;
+    atoms->buckets[i] = atoms->numAtoms;
+
+    return atoms->numAtoms++;
+}
+
+// Like intern(), but returns -1 instead of adding name if it hasn't been seen.
+ATOM findAtom(const char *name, size_t length) {
+    const ATOM_TABLE *atoms = &cilisp->atoms;
+    if (!atoms->numBuckets)
+        return -1;
+    return atoms->buckets[findBucket(atoms, name, length)];
+}
+
+char *atomName(ATOM atom) {
+    return cilisp->atoms.names[atom];
+}
+
+// Frees the spellings and the hash set of atoms, which must not be used again.
+void freeAtoms(ATOM_TABLE *atoms) {
+    for (ATOM atom = 0; atom < atoms->numAtoms; ++atom)
+        free(atoms->names[atom]);
+    free(atoms->names);
+    free(atoms->lengths);
+    free(atoms->buckets);
+    *atoms = (ATOM_TABLE) {0};
+}
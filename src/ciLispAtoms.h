@@ -0,0 +1,30 @@
+#ifndef __cilisp_atoms_h_
+#define __cilisp_atoms_h_
+
+#include <stddef.h>
+
+// Identifiers (symbols, function and type names) are interned by the scanner:
+// every distinct spelling gets one ATOM for the life of the interpreter,
+// so identifiers are compared as integers and never copied or freed.
+typedef int ATOM;
+
+// One interpreter's atoms (see CILISP); the functions below work on the current interpreter's.
+typedef struct {
+    // spellings of all interned atoms, indexed by ATOM
+    char **names;
+    size_t *lengths;
+    int numAtoms;
+    int capacity;
+
+    // open addressing hash set of ATOMs; -1 marks an empty bucket.
+    // numBuckets is a power of two and kept at least twice numAtoms.
+    ATOM *buckets;
+    size_t numBuckets;
+} ATOM_TABLE;
+
+ATOM intern(const char *name, size_t length);
+ATOM findAtom(const char *name, size_t length);
+char *atomName(ATOM atom);
+void freeAtoms(ATOM_TABLE *atoms);
+
+#endif
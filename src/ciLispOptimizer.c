@@ -0,0 +1,836 @@
+#include "ciLispOptimizer.h"
+
+// Largest lambda body, in AST nodes, that is inlined at its call sites (cmake -DCILISP_INLINE_SIZE=n, 0 for none).
+#ifndef INLINE_MAX_SIZE
+#define INLINE_MAX_SIZE 16
+#endif
+
+static _Thread_local OPTIMIZER_STATS stats;
+
+// True for builtins whose result depends on nothing but their operands.
+static bool isPure(OPER_TYPE oper) {
+    return oper != READ_OPER && oper != RAND_OPER && oper != PRINT_OPER && oper != CUSTOM_OPER;
+}
+
+// Replaces a call to a pure builtin whose operands are all numbers by the number it evaluates to.
+// The value comes from evalBuiltin(), which shares the VM's builtins, so the int/double typing rules
+// and the integer arithmetic are exactly those of evaluation.
+static AST_NODE *foldFuncNode(AST_NODE *node) {
+    OPER_TYPE oper = node->data.function.oper;
+    if (!isPure(oper))
+        return node;
+
+    // extra operands to fixed arity builtins were already warned about and are ignored
+    int arity = operArity(oper), numOps = 0;
+    for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+        if (op->type != NUM_NODE_TYPE)
+            return node;
+        if (numOps != arity)
+            numOps++;
+    }
+
+    RET_VAL *ops;
+    if ((ops = arenaAlloc((numOps + 1) * sizeof(RET_VAL))) == NULL)
+        yyerror("Memory allocation failed!");
+    AST_NODE *op = node->data.function.opList;
+    for (int i = 0; i < numOps; ++i, op = op->next)
+        ops[i] = op->data.number;
+
+    RET_VAL value = evalBuiltin(oper, ops, numOps);
+    stats.folded++;
+    return createNumberNode(value);
+}
+
+// Replaces a symbol bound to a number by that number, so conds on let bound flags can be pruned
+// and calls on let bound constants folded. Typed bindings are only replaced when the number already
+// has the binding's type, leaving the conversion (and its precision warning) to evaluation.
+static AST_NODE *propagateSymbolNode(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    int depth, slot;
+    TABLE_NODE *tableNode = resolveIdent(scopes, node->data.symbol.ident, &depth, &slot);
+    if (tableNode->nodeType != SYMBOL_TABLE_NODE_TYPE || !tableNode->data.symbol.val)
+        return node;
+
+    AST_NODE *val = tableNode->data.symbol.val;
+    if (val->type != NUM_NODE_TYPE || (tableNode->type != NO_TYPE && tableNode->type != numType(val->data.number)))
+        return node;
+
+    stats.propagated++;
+    return createNumberNode(val->data.number);
+}
+
+// Replaces a cond whose condition is a number by the branch it always takes, with the test OP_JUMP_IF_FALSE makes.
+// The branch not taken is dropped, and with it whatever references it made to let bindings (see dropUnused()).
+static AST_NODE *pruneCondNode(AST_NODE *node) {
+    if (node->data.condition.cond->type != NUM_NODE_TYPE)
+        return node;
+
+    stats.pruned++;
+    return numValue(node->data.condition.cond->data.number) == 0 ? node->data.condition.ifFalse
+                                                                 : node->data.condition.ifTrue;
+}
+
+// What replaces original, a let value or custom function call operand that a pass turned into optimized.
+// Such a value or operand that is a read or rand call is evaluated when the let is entered or before the call
+// (see isEagerValue()) rather than when it is used, so one that only became one through inlining, pruning or
+// dropping an emptied let section is kept as it was.
+static AST_NODE *keepLazy(AST_NODE *original, AST_NODE *optimized) {
+    return isEagerValue(optimized) && !isEagerValue(original) ? original : optimized;
+}
+
+// Inlining. A call to a small custom function whose body has no let sections or custom function
+// calls of its own (so no recursive one) is replaced by a copy of the body with the arguments
+// substituted for the parameters, which constant folding then sees through.
+
+// One argument of the call being inlined.
+typedef struct {
+    ATOM param;
+    AST_NODE *node;      // the operand
+    int uses;            // of param in the body
+    TABLE_NODE *binding; // the let binding evaluating node, when it can't be substituted at each use
+} INLINE_ARG;
+
+static _Thread_local int inlinedBindings; // bindings made for the current top level expression, to name them
+
+#ifndef CALL_BY_NAME
+// How many let bindings deep isPureTree() follows symbols before giving up on them.
+#define PURE_SYMBOL_DEPTH 8
+
+// True if node has no side effects: no read, rand, print or custom function calls, and no let sections.
+// A let bound symbol's value is evaluated the first time the symbol is used, so a symbol has the side effects
+// of its value, and a precision warning if it is bound as an int. scopes are those node is evaluated in, as in resolve().
+static bool isPureTree(AST_NODE *node, const RESOLVE_SCOPE *scopes, int symbolDepth) {
+    int depth, slot;
+    TABLE_NODE *binding;
+    AST_NODE *val;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            return true;
+        case SYMBOL_NODE_TYPE:
+            binding = resolveIdent(scopes, node->data.symbol.ident, &depth, &slot);
+            if (binding->nodeType == FUNC_TABLE_NODE_TYPE)
+                return true;
+            // arguments, and read and rand values, are evaluated before anything can use them
+            val = binding->data.symbol.val;
+            if (!val || isEagerValue(val))
+                return true;
+            if (symbolDepth == 0 || (binding->type == INT_TYPE && val->type != NUM_NODE_TYPE))
+                return false;
+            while (depth--)
+                scopes = scopes->parent;
+            return isPureTree(val, scopes, symbolDepth - 1);
+        case FUNC_NODE_TYPE:
+            if (!isPure(node->data.function.oper))
+                return false;
+            for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+                if (!isPureTree(op, scopes, symbolDepth))
+                    return false;
+            }
+            return true;
+        case COND_NODE_TYPE:
+            return isPureTree(node->data.condition.cond, scopes, symbolDepth)
+                   && isPureTree(node->data.condition.ifTrue, scopes, symbolDepth)
+                   && isPureTree(node->data.condition.ifFalse, scopes, symbolDepth);
+        default:
+            return false;
+    }
+}
+#endif
+
+// Number of nodes in the lambda body node, or -1 if it has let sections or custom function calls.
+static int inlineSize(AST_NODE *node) {
+    int size = 1, opSize;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+        case SYMBOL_NODE_TYPE:
+            break;
+        case FUNC_NODE_TYPE:
+            if (node->data.function.oper == CUSTOM_OPER)
+                return -1;
+            for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+                if ((opSize = inlineSize(op)) < 0)
+                    return -1;
+                size += opSize;
+            }
+            break;
+        case COND_NODE_TYPE:
+            if ((opSize = inlineSize(node->data.condition.cond)) < 0)
+                return -1;
+            size += opSize;
+            if ((opSize = inlineSize(node->data.condition.ifTrue)) < 0)
+                return -1;
+            size += opSize;
+            if ((opSize = inlineSize(node->data.condition.ifFalse)) < 0)
+                return -1;
+            size += opSize;
+            break;
+        case LET_NODE_TYPE:
+            return -1;
+    }
+
+    return size;
+}
+
+// Finds the argument a symbol of the body refers to, if any.
+static INLINE_ARG *findArg(INLINE_ARG *args, int numArgs, ATOM ident) {
+    for (int i = 0; i < numArgs; ++i) {
+        if (args[i].param == ident)
+            return &args[i];
+    }
+    return NULL;
+}
+
+// Counts the uses of each parameter in the body node, and returns false if some other symbol in it
+// would mean something else at the call site than where the lambda is defined.
+static bool scanBody(AST_NODE *node, INLINE_ARG *args, int numArgs,
+                     const RESOLVE_SCOPE *defining, const RESOLVE_SCOPE *scopes) {
+    int depth, slot;
+    INLINE_ARG *arg;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            return true;
+        case SYMBOL_NODE_TYPE:
+            if ((arg = findArg(args, numArgs, node->data.symbol.ident))) {
+                arg->uses++;
+                return true;
+            }
+            return resolveIdent(defining, node->data.symbol.ident, &depth, &slot)
+                   == resolveIdent(scopes, node->data.symbol.ident, &depth, &slot);
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+                if (!scanBody(op, args, numArgs, defining, scopes))
+                    return false;
+            }
+            return true;
+        case COND_NODE_TYPE:
+            return scanBody(node->data.condition.cond, args, numArgs, defining, scopes)
+                   && scanBody(node->data.condition.ifTrue, args, numArgs, defining, scopes)
+                   && scanBody(node->data.condition.ifFalse, args, numArgs, defining, scopes);
+        default:
+            return false;
+    }
+}
+
+// Copies a tree without let sections (see isCopyable()).
+static AST_NODE *copyTree(AST_NODE *node);
+
+#ifdef CALL_BY_NAME
+static bool isCopyable(AST_NODE *node) {
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+        case SYMBOL_NODE_TYPE:
+            return true;
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+                if (!isCopyable(op))
+                    return false;
+            }
+            return true;
+        case COND_NODE_TYPE:
+            return isCopyable(node->data.condition.cond) && isCopyable(node->data.condition.ifTrue)
+                   && isCopyable(node->data.condition.ifFalse);
+        default:
+            return false;
+    }
+}
+#endif
+
+// Returns what replaces one use of arg in the body.
+// The operand is copied even when it is used once, so the call is left intact for optimizeNode() to go back to.
+static AST_NODE *argUse(INLINE_ARG *arg) {
+    if (arg->binding)
+        return createSymbolNode(arg->binding->ident);
+    return copyTree(arg->node);
+}
+
+// Copies the body node, replacing each parameter by its argument (args is NULL to copy it as is).
+static AST_NODE *substitute(AST_NODE *node, INLINE_ARG *args, int numArgs) {
+    AST_NODE *result = NULL, *op, **last;
+    INLINE_ARG *arg;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            return createNumberNode(node->data.number);
+        case SYMBOL_NODE_TYPE:
+            if (args && (arg = findArg(args, numArgs, node->data.symbol.ident)))
+                return argUse(arg);
+            return createSymbolNode(node->data.symbol.ident);
+        case FUNC_NODE_TYPE:
+            // not createFunctionNode(), which would check the operands again and print the same errors
+            if ((result = arenaAlloc(AST_NODE_SIZE(function))) == NULL)
+                yyerror("Memory allocation failed!");
+            result->type = FUNC_NODE_TYPE;
+            result->data.function = node->data.function;
+            last = &result->data.function.opList;
+            for (op = node->data.function.opList; op; op = op->next) {
+                *last = substitute(op, args, numArgs);
+                (*last)->next = NULL;
+                last = &(*last)->next;
+            }
+            return result;
+        case COND_NODE_TYPE:
+            return createCondNode(substitute(node->data.condition.cond, args, numArgs),
+                                  substitute(node->data.condition.ifTrue, args, numArgs),
+                                  substitute(node->data.condition.ifFalse, args, numArgs));
+        default:
+            yyerror("Invalid AST_NODE_TYPE, probably invalid writes somewhere!");
+            return NULL;
+    }
+}
+
+static AST_NODE *copyTree(AST_NODE *node) {
+    return substitute(node, NULL, 0);
+}
+
+// Returns the inlined body replacing the custom function call node, or NULL if it isn't inlined.
+// Arguments are evaluated once each, before the body, so only calls whose arguments are pure are inlined;
+// an argument used more than once that isn't a number or symbol is bound in a let section around the
+// body instead of being copied, which evaluates it at most once, as the call did.
+// Arguments passed by name (CALL_BY_NAME) are evaluated at each use, so they are always substituted,
+// except read and rand, and let sections, whose calls are not inlined.
+static AST_NODE *inlineCall(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    int depth, slot, numArgs = 0, numParams = 0, i;
+    TABLE_NODE *tableNode = resolveIdent(scopes, node->data.function.ident, &depth, &slot);
+    TABLE_NODE *param;
+    AST_NODE *op;
+
+    const RESOLVE_SCOPE *defining = scopes;
+    while (depth--)
+        defining = defining->parent;
+
+    AST_NODE *body = tableNode->data.function.customOper;
+    int size = inlineSize(body);
+    if (size < 0 || size > INLINE_MAX_SIZE)
+        return NULL;
+
+    // calls with the wrong number of arguments are left to report it when they run
+    for (param = tableNode->data.function.argList; param; param = param->next)
+        numParams++;
+    for (op = node->data.function.opList; op; op = op->next)
+        numArgs++;
+    if (numArgs != numParams)
+        return NULL;
+
+    INLINE_ARG *args;
+    if ((args = arenaAlloc(numArgs * sizeof(INLINE_ARG) + 1)) == NULL)
+        yyerror("Memory allocation failed!");
+    for (i = 0, param = tableNode->data.function.argList, op = node->data.function.opList;
+         param; ++i, param = param->next, op = op->next) {
+        args[i] = (INLINE_ARG) {param->ident, op, 0, NULL};
+    }
+
+    if (!scanBody(body, args, numArgs, defining, scopes))
+        return NULL;
+
+    TABLE_NODE *bindings = NULL;
+    for (i = 0; i < numArgs; ++i) {
+#ifdef CALL_BY_NAME
+        // read and rand operands are evaluated once, before the call, however often they are used;
+        // and every use, even a single one, is a copy, which copyTree() can't make of a let section
+        if (isEagerValue(args[i].node) || !isCopyable(args[i].node))
+            return NULL;
+#else
+        if (!isPureTree(args[i].node, scopes, PURE_SYMBOL_DEPTH))
+            return NULL;
+        if (args[i].uses > 1 && args[i].node->type != NUM_NODE_TYPE && args[i].node->type != SYMBOL_NODE_TYPE) {
+            char name[16];
+            snprintf(name, sizeof(name), "arg%d", ++inlinedBindings); // symbols can't end in digits
+            args[i].binding = createSymbolTableNode(intern(name, strlen(name)), args[i].node, NO_TYPE);
+            args[i].binding->next = bindings;
+            bindings = args[i].binding;
+        }
+#endif
+    }
+
+    stats.inlined++;
+    AST_NODE *result = substitute(body, args, numArgs);
+    return bindings ? createLetNode(bindings, result) : result;
+}
+
+// Optimizes the tree rooted at node, bottom up, and returns the node that replaces it.
+// scopes are the let sections and arg_lists enclosing node, as in resolve().
+// The replacement's next is left for the caller to set.
+static AST_NODE *optimizeNode(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    if (!node)
+        return NULL;
+
+    AST_NODE **op, *next, *inlined;
+    TABLE_NODE *temp;
+    RESOLVE_SCOPE inner;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            break;
+        case SYMBOL_NODE_TYPE:
+            node = propagateSymbolNode(node, scopes);
+            break;
+        case FUNC_NODE_TYPE:
+            for (op = &node->data.function.opList; *op; op = &(*op)->next) {
+                next = (*op)->next;
+                if (node->data.function.oper == CUSTOM_OPER)
+                    *op = keepLazy(*op, optimizeNode(*op, scopes));
+                else
+                    *op = optimizeNode(*op, scopes);
+                (*op)->next = next;
+            }
+            if (node->data.function.oper == CUSTOM_OPER && (inlined = inlineCall(node, scopes)))
+                // the body is optimized again with the arguments in it, which may fold it to a number
+                return optimizeNode(inlined, scopes);
+            node = foldFuncNode(node);
+            break;
+        case COND_NODE_TYPE:
+            node->data.condition.cond = optimizeNode(node->data.condition.cond, scopes);
+            node->data.condition.ifTrue = optimizeNode(node->data.condition.ifTrue, scopes);
+            node->data.condition.ifFalse = optimizeNode(node->data.condition.ifFalse, scopes);
+            node = pruneCondNode(node);
+            break;
+        case LET_NODE_TYPE:
+            inner = (RESOLVE_SCOPE) {node->data.let.symbolTable, scopes};
+            for (temp = node->data.let.symbolTable; temp; temp = temp->next) {
+                if (temp->nodeType == FUNC_TABLE_NODE_TYPE) {
+                    RESOLVE_SCOPE args = {temp->data.function.argList, &inner};
+                    temp->data.function.customOper = optimizeNode(temp->data.function.customOper, &args);
+                } else {
+                    temp->data.symbol.val = keepLazy(temp->data.symbol.val,
+                                                     optimizeNode(temp->data.symbol.val, &inner));
+                }
+            }
+            node->data.let.body = optimizeNode(node->data.let.body, &inner);
+            break;
+    }
+
+    return node;
+}
+
+static void markUses(AST_NODE *node, const RESOLVE_SCOPE *scopes);
+
+// Marks tableNode used, and with it everything its value or lambda body refers to.
+// defining is the scope the entry was found in, so its value is walked in the scope it is evaluated in.
+static void markUsed(TABLE_NODE *tableNode, const RESOLVE_SCOPE *defining) {
+    if (tableNode->used)
+        return;
+    tableNode->used = true;
+
+    if (tableNode->nodeType == FUNC_TABLE_NODE_TYPE) {
+        RESOLVE_SCOPE args = {tableNode->data.function.argList, defining};
+        markUses(tableNode->data.function.customOper, &args);
+    } else {
+        markUses(tableNode->data.symbol.val, defining);
+    }
+}
+
+// Marks the binding ident refers to from scopes.
+static void markReference(const RESOLVE_SCOPE *scopes, ATOM ident) {
+    int depth, slot;
+    TABLE_NODE *tableNode = resolveIdent(scopes, ident, &depth, &slot);
+    while (depth--)
+        scopes = scopes->parent;
+    markUsed(tableNode, scopes);
+}
+
+// Marks the let bindings that node refers to, then those their values refer to, and so on,
+// so afterwards exactly the bindings that can ever be evaluated are used.
+// Read and rand values are evaluated whether they are referred to or not and are always used.
+static void markUses(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    if (!node)
+        return;
+
+    RESOLVE_SCOPE inner;
+    TABLE_NODE *temp;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            break;
+        case SYMBOL_NODE_TYPE:
+            markReference(scopes, node->data.symbol.ident);
+            break;
+        case FUNC_NODE_TYPE:
+            if (node->data.function.oper == CUSTOM_OPER)
+                markReference(scopes, node->data.function.ident);
+            for (AST_NODE *op = node->data.function.opList; op; op = op->next)
+                markUses(op, scopes);
+            break;
+        case COND_NODE_TYPE:
+            markUses(node->data.condition.cond, scopes);
+            markUses(node->data.condition.ifTrue, scopes);
+            markUses(node->data.condition.ifFalse, scopes);
+            break;
+        case LET_NODE_TYPE:
+            inner = (RESOLVE_SCOPE) {node->data.let.symbolTable, scopes};
+            for (temp = node->data.let.symbolTable; temp; temp = temp->next)
+                temp->used = false;
+            for (temp = node->data.let.symbolTable; temp; temp = temp->next) {
+                if (temp->nodeType == SYMBOL_TABLE_NODE_TYPE && isEagerValue(temp->data.symbol.val))
+                    markUsed(temp, &inner);
+            }
+            markUses(node->data.let.body, &inner);
+            break;
+    }
+}
+
+// Removes the let bindings markUses() left unused from the tree rooted at node,
+// and any let section left with none, and returns the node that replaces node.
+// Only reachable code is walked: unused bindings, and everything under them, are dropped whole.
+static AST_NODE *dropUnused(AST_NODE *node) {
+    if (!node)
+        return NULL;
+
+    AST_NODE **op, *next;
+    TABLE_NODE **temp;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+        case SYMBOL_NODE_TYPE:
+            break;
+        case FUNC_NODE_TYPE:
+            for (op = &node->data.function.opList; *op; op = &(*op)->next) {
+                next = (*op)->next;
+                if (node->data.function.oper == CUSTOM_OPER)
+                    *op = keepLazy(*op, dropUnused(*op));
+                else
+                    *op = dropUnused(*op);
+                (*op)->next = next;
+            }
+            break;
+        case COND_NODE_TYPE:
+            node->data.condition.cond = dropUnused(node->data.condition.cond);
+            node->data.condition.ifTrue = dropUnused(node->data.condition.ifTrue);
+            node->data.condition.ifFalse = dropUnused(node->data.condition.ifFalse);
+            break;
+        case LET_NODE_TYPE:
+            for (temp = &node->data.let.symbolTable; *temp;) {
+                if (!(*temp)->used) {
+                    stats.dropped++;
+                    *temp = (*temp)->next;
+                    continue;
+                }
+                if ((*temp)->nodeType == FUNC_TABLE_NODE_TYPE)
+                    (*temp)->data.function.customOper = dropUnused((*temp)->data.function.customOper);
+                else
+                    (*temp)->data.symbol.val = keepLazy((*temp)->data.symbol.val,
+                                                        dropUnused((*temp)->data.symbol.val));
+                temp = &(*temp)->next;
+            }
+            node->data.let.body = dropUnused(node->data.let.body);
+            if (!node->data.let.symbolTable)
+                node = node->data.let.body;
+            break;
+    }
+
+    return node;
+}
+
+// Common subexpression elimination.
+// The tree is split into regions whose symbols all mean the same thing: the top level expression,
+// each let section (its values and its body) and each lambda body, none of them including the let
+// sections nested in them. A pure subtree occurring more than once in a region is moved into a new
+// let binding of the region, and every occurrence replaced by a reference to it. Let values are
+// evaluated at most once, the first time they are used, so the subtree is evaluated once per
+// evaluation of the region, and not at all when no occurrence is reached.
+
+// Subtrees with fewer builtin calls than this are cheaper to evaluate again than to share.
+#define CSE_MIN_CALLS 2
+
+// What eliminateCommon() needs to know about a subtree.
+typedef struct {
+    unsigned hash;  // equal for subtrees that sameTree() considers equal
+    int calls;      // builtin calls in the subtree
+    bool pure;      // pure builtin calls, numbers and symbols only
+} SHAPE;
+
+// A repeated subtree of the region being rewritten.
+typedef struct {
+    unsigned hash;
+    AST_NODE *node;      // its first occurrence
+    int count;           // occurrences left in the region
+    TABLE_NODE *binding; // the let binding that shares it, once the first occurrence has been moved into it
+} CSE_ENTRY;
+
+// Open addressing hash table of the shareable subtrees of a region, and the bindings made for them.
+typedef struct {
+    CSE_ENTRY *entries;
+    int capacity; // a power of two
+    int size;
+    int repeated; // entries counted more than once
+    TABLE_NODE *bindings;
+    TABLE_NODE *lastBinding;
+} CSE_TABLE;
+
+static _Thread_local int cseBindings; // bindings made for the current top level expression, to name them
+
+static unsigned hashMix(unsigned hash, unsigned value) {
+    return (hash ^ value) * 16777619u;
+}
+
+static SHAPE shapeOf(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    SHAPE shape = {2166136261u, 0, false};
+    uint64_t bits;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            // boxed integers are compared by value, see sameTree()
+            bits = numType(node->data.number) == INT_TYPE ? (uint64_t) intOf(node->data.number) : node->data.number.bits;
+            shape.hash = hashMix(hashMix(hashMix(shape.hash, numType(node->data.number)), (unsigned) bits),
+                                 (unsigned) (bits >> 32));
+            shape.pure = true;
+            break;
+        case SYMBOL_NODE_TYPE:
+            shape.hash = hashMix(hashMix(shape.hash, SYMBOL_NODE_TYPE), node->data.symbol.ident);
+            shape.pure = true;
+#ifdef CALL_BY_NAME
+            {
+                // arguments bound by name are evaluated again on every use
+                int depth, slot;
+                TABLE_NODE *tableNode = resolveIdent(scopes, node->data.symbol.ident, &depth, &slot);
+                shape.pure = !tableNode || tableNode->nodeType != SYMBOL_TABLE_NODE_TYPE || tableNode->data.symbol.val;
+            }
+#endif
+            break;
+        case FUNC_NODE_TYPE:
+            shape.hash = hashMix(hashMix(shape.hash, FUNC_NODE_TYPE), node->data.function.oper);
+            shape.calls = 1;
+            shape.pure = isPure(node->data.function.oper);
+            for (AST_NODE *op = node->data.function.opList; op && shape.pure; op = op->next) {
+                SHAPE opShape = shapeOf(op, scopes);
+                shape.hash = hashMix(shape.hash, opShape.hash);
+                shape.calls += opShape.calls;
+                shape.pure = opShape.pure;
+            }
+            break;
+        case COND_NODE_TYPE:
+        case LET_NODE_TYPE:
+            break;
+    }
+
+    return shape;
+}
+
+static bool sameTree(AST_NODE *a, AST_NODE *b) {
+    if (a->type != b->type)
+        return false;
+
+    switch (a->type) {
+        case NUM_NODE_TYPE:
+            if (numType(a->data.number) == INT_TYPE && numType(b->data.number) == INT_TYPE)
+                return intOf(a->data.number) == intOf(b->data.number);
+            return a->data.number.bits == b->data.number.bits;
+        case SYMBOL_NODE_TYPE:
+            return a->data.symbol.ident == b->data.symbol.ident;
+        case FUNC_NODE_TYPE:
+            if (a->data.function.oper != b->data.function.oper)
+                return false;
+            for (a = a->data.function.opList, b = b->data.function.opList; a && b; a = a->next, b = b->next) {
+                if (!sameTree(a, b))
+                    return false;
+            }
+            return !a && !b;
+        default:
+            return false;
+    }
+}
+
+// Returns the entry for node, adding one with a count of 0 if there is none.
+static CSE_ENTRY *findEntry(CSE_TABLE *table, AST_NODE *node, unsigned hash) {
+    if (2 * (table->size + 1) > table->capacity) {
+        CSE_TABLE grown = *table;
+        grown.capacity = table->capacity ? 2 * table->capacity : 16;
+        grown.size = 0;
+        if ((grown.entries = arenaAlloc(grown.capacity * sizeof(CSE_ENTRY))) == NULL)
+            yyerror("Memory allocation failed!");
+        for (int i = 0; i < table->capacity; ++i) {
+            if (table->entries[i].node)
+                *findEntry(&grown, table->entries[i].node, table->entries[i].hash) = table->entries[i];
+        }
+        *table = grown;
+    }
+
+    int i = hash & (table->capacity - 1);
+    while (table->entries[i].node) {
+        if (table->entries[i].hash == hash && sameTree(table->entries[i].node, node))
+            return &table->entries[i];
+        i = (i + 1) & (table->capacity - 1);
+    }
+
+    table->size++;
+    table->entries[i] = (CSE_ENTRY) {hash, node, 0, NULL};
+    return &table->entries[i];
+}
+
+// Counts the occurrences of the shareable subtrees of the region containing node, and returns node's shape.
+// Computes the same shapes as shapeOf(), but bottom up, visiting each node once.
+static SHAPE countNode(AST_NODE *node, CSE_TABLE *table, const RESOLVE_SCOPE *scopes) {
+    SHAPE shape = {2166136261u, 0, false};
+    CSE_ENTRY *entry;
+
+    switch (node->type) {
+        case FUNC_NODE_TYPE:
+            shape.hash = hashMix(hashMix(shape.hash, FUNC_NODE_TYPE), node->data.function.oper);
+            shape.calls = 1;
+            shape.pure = isPure(node->data.function.oper);
+            for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+                SHAPE opShape = countNode(op, table, scopes);
+                shape.hash = hashMix(shape.hash, opShape.hash);
+                shape.calls += opShape.calls;
+                shape.pure = shape.pure && opShape.pure;
+            }
+            if (shape.pure && shape.calls >= CSE_MIN_CALLS) {
+                entry = findEntry(table, node, shape.hash);
+                if (++entry->count == 2)
+                    table->repeated++;
+            }
+            break;
+        case COND_NODE_TYPE:
+            countNode(node->data.condition.cond, table, scopes);
+            countNode(node->data.condition.ifTrue, table, scopes);
+            countNode(node->data.condition.ifFalse, table, scopes);
+            break;
+        case NUM_NODE_TYPE:
+        case SYMBOL_NODE_TYPE:
+            shape = shapeOf(node, scopes);
+            break;
+        case LET_NODE_TYPE:
+            // let sections are regions of their own
+            break;
+    }
+
+    return shape;
+}
+
+// Takes copies occurrences of each shareable subtree strictly inside node off the counts.
+static void uncountInside(AST_NODE *node, CSE_TABLE *table, const RESOLVE_SCOPE *scopes, int copies) {
+    for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+        if (op->type != FUNC_NODE_TYPE)
+            continue;
+        SHAPE shape = shapeOf(op, scopes);
+        if (shape.pure && shape.calls >= CSE_MIN_CALLS)
+            findEntry(table, op, shape.hash)->count -= copies;
+        uncountInside(op, table, scopes, copies);
+    }
+}
+
+static void eliminateInLet(AST_NODE *node, const RESOLVE_SCOPE *scopes);
+static AST_NODE *eliminateInRegion(AST_NODE *node, const RESOLVE_SCOPE *scopes);
+
+// Replaces the repeated subtrees of the region containing node by references to their bindings,
+// making the binding at the first occurrence, and returns the node that replaces node.
+static AST_NODE *rewriteNode(AST_NODE *node, CSE_TABLE *table, const RESOLVE_SCOPE *scopes) {
+    AST_NODE **op, *next;
+    CSE_ENTRY *entry;
+    SHAPE shape;
+    char name[16];
+
+    switch (node->type) {
+        case FUNC_NODE_TYPE:
+            shape = table->repeated ? shapeOf(node, scopes) : (SHAPE) {0, 0, false};
+            entry = shape.pure && shape.calls >= CSE_MIN_CALLS ? findEntry(table, node, shape.hash) : NULL;
+            if (entry && entry->count < 2)
+                entry = NULL;
+            if (entry && entry->binding) {
+                stats.shared++;
+                return createSymbolNode(entry->binding->ident);
+            }
+            if (entry)
+                // the other occurrences go, and with them their copies of what is inside this one
+                uncountInside(node, table, scopes, entry->count - 1);
+
+            for (op = &node->data.function.opList; *op; op = &(*op)->next) {
+                next = (*op)->next;
+                *op = rewriteNode(*op, table, scopes);
+                (*op)->next = next;
+            }
+
+            if (entry) {
+                snprintf(name, sizeof(name), "cse%d", ++cseBindings); // symbols can't end in digits
+                node->next = NULL;
+                entry->binding = createSymbolTableNode(intern(name, strlen(name)), node, NO_TYPE);
+                if (table->lastBinding)
+                    table->lastBinding->next = entry->binding;
+                else
+                    table->bindings = entry->binding;
+                table->lastBinding = entry->binding;
+                stats.shared++;
+                return createSymbolNode(entry->binding->ident);
+            }
+            break;
+        case COND_NODE_TYPE:
+            node->data.condition.cond = rewriteNode(node->data.condition.cond, table, scopes);
+            node->data.condition.ifTrue = rewriteNode(node->data.condition.ifTrue, table, scopes);
+            node->data.condition.ifFalse = rewriteNode(node->data.condition.ifFalse, table, scopes);
+            break;
+        case LET_NODE_TYPE:
+            eliminateInLet(node, scopes);
+            break;
+        case NUM_NODE_TYPE:
+        case SYMBOL_NODE_TYPE:
+            break;
+    }
+
+    return node;
+}
+
+// The let section's values and body are one region; its bindings are added to the let section.
+static void eliminateInLet(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    RESOLVE_SCOPE inner = {node->data.let.symbolTable, scopes};
+    CSE_TABLE table = {0};
+    TABLE_NODE *temp, *last = NULL;
+
+    for (temp = node->data.let.symbolTable; temp; temp = temp->next) {
+        if (temp->nodeType == SYMBOL_TABLE_NODE_TYPE)
+            countNode(temp->data.symbol.val, &table, &inner);
+    }
+    countNode(node->data.let.body, &table, &inner);
+
+    for (temp = node->data.let.symbolTable; temp; last = temp, temp = temp->next) {
+        if (temp->nodeType == FUNC_TABLE_NODE_TYPE) {
+            RESOLVE_SCOPE args = {temp->data.function.argList, &inner};
+            temp->data.function.customOper = eliminateInRegion(temp->data.function.customOper, &args);
+        } else {
+            temp->data.symbol.val = rewriteNode(temp->data.symbol.val, &table, &inner);
+        }
+    }
+    node->data.let.body = rewriteNode(node->data.let.body, &table, &inner);
+
+    // dropUnused() leaves a let section it emptied when its body is a read or rand call (see keepLazy())
+    if (last)
+        last->next = table.bindings;
+    else
+        node->data.let.symbolTable = table.bindings;
+}
+
+// For the top level expression and lambda bodies: the bindings go in a new let section around node.
+static AST_NODE *eliminateInRegion(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    if (node->type == LET_NODE_TYPE) {
+        eliminateInLet(node, scopes);
+        return node;
+    }
+
+    CSE_TABLE table = {0};
+    countNode(node, &table, scopes);
+    node = rewriteNode(node, &table, scopes);
+    return table.bindings ? createLetNode(table.bindings, node) : node;
+}
+
+// Called on each top level expression after resolve() and before compile() (see the form production in ciLisp.y).
+// Returns the root of the optimized tree; the nodes it replaced are left in the arena.
+AST_NODE *optimize(AST_NODE *node) {
+    stats = (OPTIMIZER_STATS) {0};
+    inlinedBindings = 0;
+    node = optimizeNode(node, NULL);
+
+    markUses(node, NULL);
+    node = dropUnused(node);
+
+    cseBindings = 0;
+    node = eliminateInRegion(node, NULL);
+
+    // dropping bindings moves the slots of the ones after them, and new and dropped let sections change depths
+    if (stats.inlined || stats.dropped || stats.shared)
+        resolveAgain(node);
+    return node;
+}
+
+OPTIMIZER_STATS optimizerStats() {
+    return stats;
+}
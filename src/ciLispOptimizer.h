@@ -0,0 +1,19 @@
+#ifndef __cilisp_optimizer_h_
+#define __cilisp_optimizer_h_
+
+#include "ciLisp.h"
+
+// Counts of the rewrites optimize() made to the last top level expression (see TRACE_STATS).
+typedef struct {
+    int inlined;    // custom function calls replaced by the function's body
+    int propagated; // symbols replaced by the number they are bound to
+    int folded;     // calls to pure builtins replaced by the number they evaluate to
+    int pruned;     // conds replaced by the branch their constant condition always takes
+    int dropped;    // let bindings removed because nothing that can run refers to them
+    int shared;     // repeated pure subtrees replaced by a reference to a let binding evaluating them once
+} OPTIMIZER_STATS;
+
+AST_NODE *optimize(AST_NODE *node);
+OPTIMIZER_STATS optimizerStats();
+
+#endif
@@ -0,0 +1,167 @@
+#include "ciLispTypes.h"
+
+// Static types. Every node is given the type each of its evaluations has, INT_TYPE or DOUBLE_TYPE,
+// or NO_TYPE when that depends on values only known at run time: custom function arguments,
+// read, the sign of exp2's operand, a function's own recursive calls.
+// The rules are those of the builtins in ciLisp.c (unaryOper(), binaryOper(), addOper() to divOper()),
+// and compile() relies on them: a node typed INT_TYPE or DOUBLE_TYPE never evaluates to anything else.
+
+static _Thread_local TYPE_STATS stats;
+
+static NUM_TYPE inferNode(AST_NODE *node, const RESOLVE_SCOPE *scopes);
+
+// The type of arithmetic on values of types a and b: DOUBLE_TYPE if either is, INT_TYPE if both are.
+static NUM_TYPE arithType(NUM_TYPE a, NUM_TYPE b) {
+    if (a == DOUBLE_TYPE || b == DOUBLE_TYPE)
+        return DOUBLE_TYPE;
+    return a == INT_TYPE && b == INT_TYPE ? INT_TYPE : NO_TYPE;
+}
+
+// The type of a let binding's value or of a lambda's result, inferred the first time it is needed.
+// defining are the scopes of the let section the binding is in, which its value is evaluated in.
+static NUM_TYPE bindingType(TABLE_NODE *binding, const RESOLVE_SCOPE *defining) {
+    if (binding->inferred)
+        return binding->valueType;
+
+    // a binding that refers back to itself, directly or through others, has NO_TYPE there
+    binding->inferred = true;
+    binding->valueType = NO_TYPE;
+
+    RESOLVE_SCOPE args;
+    if (binding->nodeType == FUNC_TABLE_NODE_TYPE) {
+        args = (RESOLVE_SCOPE) {binding->data.function.argList, defining};
+        binding->valueType = inferNode(binding->data.function.customOper, &args);
+    } else if (binding->data.symbol.val) {
+        binding->valueType = inferNode(binding->data.symbol.val, defining);
+    }
+
+    return binding->valueType;
+}
+
+// The type of what ident refers to: the value of a symbol, or the result of a custom function call.
+static NUM_TYPE referenceType(ATOM ident, const RESOLVE_SCOPE *scopes, bool call) {
+    int depth, slot;
+    TABLE_NODE *binding = resolveIdent(scopes, ident, &depth, &slot);
+    if (!binding || (binding->nodeType == FUNC_TABLE_NODE_TYPE) != call)
+        return NO_TYPE;
+
+    // arguments have no value of their own to infer from (val is NULL)
+    const RESOLVE_SCOPE *defining = scopes;
+    while (depth--)
+        defining = defining->parent;
+
+    return bindingType(binding, defining);
+}
+
+static NUM_TYPE inferFuncNode(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    OPER_TYPE oper = node->data.function.oper;
+    NUM_TYPE first = NO_TYPE, second = NO_TYPE, last = NO_TYPE, all = INT_TYPE;
+    int numOps = 0;
+
+    for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+        last = inferNode(op, scopes);
+        if (numOps == 0)
+            first = last;
+        else if (numOps == 1)
+            second = last;
+        all = arithType(all, last);
+        numOps++;
+    }
+
+    switch (oper) {
+        case READ_OPER:
+            return NO_TYPE;
+        case RAND_OPER:
+            return DOUBLE_TYPE;
+
+        case NEG_OPER:
+        case ABS_OPER:
+            return first;
+        case EXP_OPER:
+        case SQRT_OPER:
+        case LOG_OPER:
+        case CBRT_OPER:
+            return DOUBLE_TYPE;
+        case EXP2_OPER:
+            // negative integers give a DOUBLE_TYPE
+            return first == DOUBLE_TYPE ? DOUBLE_TYPE : NO_TYPE;
+
+        case HYPOT_OPER:
+            return DOUBLE_TYPE;
+        case REMAINDER_OPER:
+        case POW_OPER:
+        case MAX_OPER:
+        case MIN_OPER:
+        case EQUAL_OPER:
+        case LESS_OPER:
+        case GREATER_OPER:
+            return arithType(first, second);
+
+        case ADD_OPER:
+        case SUB_OPER:
+        case MULT_OPER:
+        case DIV_OPER:
+            return all;
+        case PRINT_OPER:
+            // print with no operands has no value at all
+            return numOps ? last : NO_TYPE;
+
+        case CUSTOM_OPER:
+            return referenceType(node->data.function.ident, scopes, true);
+    }
+
+    return NO_TYPE;
+}
+
+// Infers the type of node and everything under it, and sets their valueTypes.
+// scopes are the let sections and arg_lists enclosing node, as in resolve().
+static NUM_TYPE inferNode(AST_NODE *node, const RESOLVE_SCOPE *scopes) {
+    if (!node)
+        return NO_TYPE;
+
+    NUM_TYPE type = NO_TYPE;
+    RESOLVE_SCOPE inner;
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            type = numType(node->data.number);
+            break;
+        case SYMBOL_NODE_TYPE:
+            type = referenceType(node->data.symbol.ident, scopes, false);
+            break;
+        case FUNC_NODE_TYPE:
+            type = inferFuncNode(node, scopes);
+            break;
+        case COND_NODE_TYPE:
+            inferNode(node->data.condition.cond, scopes);
+            type = inferNode(node->data.condition.ifTrue, scopes);
+            if (inferNode(node->data.condition.ifFalse, scopes) != type)
+                type = NO_TYPE;
+            break;
+        case LET_NODE_TYPE:
+            inner = (RESOLVE_SCOPE) {node->data.let.symbolTable, scopes};
+            // lambdas nothing calls are typed too, so every node compile() sees has its type
+            for (TABLE_NODE *temp = node->data.let.symbolTable; temp; temp = temp->next)
+                bindingType(temp, &inner);
+            type = inferNode(node->data.let.body, &inner);
+            break;
+    }
+
+    stats.nodes++;
+    if (type != NO_TYPE)
+        stats.typed++;
+
+    node->valueType = type;
+    return type;
+}
+
+// Sets the valueType of every node of the tree rooted at node, and of every let binding in it.
+// The tree must have been through resolve(), and is not changed otherwise.
+void inferTypes(AST_NODE *node) {
+    stats = (TYPE_STATS) {0};
+    inferNode(node, NULL);
+}
+
+TYPE_STATS typeStats() {
+    return stats;
+}
@@ -0,0 +1,15 @@
+#ifndef __cilisp_types_h_
+#define __cilisp_types_h_
+
+#include "ciLisp.h"
+
+// How much of the last top level expression inferTypes() could type (see TRACE_STATS).
+typedef struct {
+    int nodes; // AST nodes visited
+    int typed; // of those, the ones given INT_TYPE or DOUBLE_TYPE
+} TYPE_STATS;
+
+void inferTypes(AST_NODE *node);
+TYPE_STATS typeStats();
+
+#endif
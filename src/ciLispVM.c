@@ -0,0 +1,741 @@
+#include "ciLispVM.h"
+
+// A run time scope: either the values of a let section or the arguments of a custom function call.
+typedef struct {
+    TABLE_NODE_TYPE nodeType;
+    int entry; // -1 if the slot holds an evaluated value
+    int numParams;
+    struct env *env; // scope the thunk or lambda body is run in
+    RET_VAL value;
+    bool byName; // the thunk is run on every use instead of once
+    int64_t big; // the box of value when it is an integer too big for the payload (see reboxInt())
+} SLOT;
+
+typedef struct env {
+    struct env *parent;
+    int numSlots;
+    SLOT slots[];
+} ENV;
+
+typedef struct {
+    int returnAddress;
+    ENV *env;
+    ENV *args; // a call's arguments: popped on return with the scopes entered after them, NULL for a thunk
+    SLOT *forcing; // let slot whose thunk is running, it keeps the returned value
+} FRAME;
+
+// tail is set for nodes whose value is returned by the lambda body they are in as it is,
+// where custom function calls are compiled to OP_TAIL_CALL.
+static void compileNode(BYTECODE *program, AST_NODE *node, bool tail);
+
+static int emit(BYTECODE *program, int word) {
+    if (program->codeSize == program->codeCapacity) {
+        program->codeCapacity = program->codeCapacity ? 2 * program->codeCapacity : 64;
+        if ((program->code = realloc(program->code, program->codeCapacity * sizeof(int))) == NULL)
+            yyerror("Memory allocation failed!");
+    }
+    program->code[program->codeSize] = word;
+    return program->codeSize++;
+}
+
+static int addConstant(BYTECODE *program, RET_VAL value) {
+    if (program->numConstants == program->constantCapacity) {
+        program->constantCapacity = program->constantCapacity ? 2 * program->constantCapacity : 16;
+        if ((program->constants = realloc(program->constants, program->constantCapacity * sizeof(RET_VAL))) == NULL)
+            yyerror("Memory allocation failed!");
+    }
+    program->constants[program->numConstants] = value;
+    return program->numConstants++;
+}
+
+static int addBinding(BYTECODE *program, TABLE_NODE *tableNode) {
+    if (program->numBindings == program->bindingCapacity) {
+        program->bindingCapacity = program->bindingCapacity ? 2 * program->bindingCapacity : 16;
+        if ((program->bindings = realloc(program->bindings, program->bindingCapacity * sizeof(BINDING))) == NULL)
+            yyerror("Memory allocation failed!");
+    }
+
+    BINDING *binding = &program->bindings[program->numBindings];
+    binding->nodeType = tableNode->nodeType;
+    binding->ident = tableNode->ident;
+    binding->type = tableNode->type;
+    binding->entry = -1;
+    binding->numParams = 0;
+
+    if (tableNode->nodeType == FUNC_TABLE_NODE_TYPE) {
+        TABLE_NODE *arg = tableNode->data.function.argList;
+        while (arg) {
+            binding->numParams++;
+            arg = arg->next;
+        }
+    }
+
+    return program->numBindings++;
+}
+
+static void compileCustomCall(BYTECODE *program, AST_NODE *node, bool tail) {
+    int numArgs = 0;
+    for (AST_NODE *op = node->data.function.opList; op; op = op->next)
+        numArgs++;
+
+#ifndef CALL_BY_NAME
+    // arguments are evaluated once, in order, and left on the stack for OP_CALL
+    for (AST_NODE *op = node->data.function.opList; op; op = op->next)
+        compileNode(program, op, false);
+
+    emit(program, tail ? OP_TAIL_CALL : OP_CALL);
+    emit(program, node->data.function.depth);
+    emit(program, node->data.function.slot);
+    emit(program, numArgs);
+#else
+    // the thunks run in the caller's scope, so it can't be popped before the call as OP_TAIL_CALL does
+    (void) tail;
+    int *entries;
+    if ((entries = calloc(numArgs + 1, sizeof(int))) == NULL)
+        yyerror("Memory allocation failed!");
+
+    // arguments are passed by name, as thunks run in the caller's scope
+    emit(program, OP_JUMP);
+    int jump = emit(program, 0);
+    int i = 0;
+    for (AST_NODE *op = node->data.function.opList; op; op = op->next, ++i) {
+        if (isEagerValue(op)) {
+            entries[i] = -1;
+            continue;
+        }
+        entries[i] = program->codeSize;
+        compileNode(program, op, false);
+        emit(program, OP_RETURN);
+    }
+    program->code[jump] = program->codeSize;
+
+    // except read and rand, which are evaluated once, before the call, and passed on the stack
+    for (AST_NODE *op = node->data.function.opList; op; op = op->next) {
+        if (isEagerValue(op))
+            compileNode(program, op, false);
+    }
+
+    emit(program, OP_CALL_BY_NAME);
+    emit(program, node->data.function.depth);
+    emit(program, node->data.function.slot);
+    emit(program, numArgs);
+    for (i = 0; i < numArgs; ++i)
+        emit(program, entries[i]);
+
+    free(entries);
+#endif
+}
+
+static void compileFuncNode(BYTECODE *program, AST_NODE *node, bool tail) {
+    OPER_TYPE oper = node->data.function.oper;
+
+    if (oper == CUSTOM_OPER) {
+        compileCustomCall(program, node, tail);
+        return;
+    }
+
+    AST_NODE *first = node->data.function.opList;
+    if (oper >= EQUAL_OPER && oper <= DIV_OPER && first && first->next && !first->next->next
+        && first->valueType == first->next->valueType && first->valueType != NO_TYPE) {
+        compileNode(program, first, false);
+        compileNode(program, first->next, false);
+        emit(program, (first->valueType == INT_TYPE ? OP_EQUAL_INT : OP_EQUAL_DOUBLE) + oper - EQUAL_OPER);
+        return;
+    }
+
+    // extra operands to fixed arity builtins were already warned about and are ignored
+    int arity = operArity(oper);
+    int numOps = 0;
+    AST_NODE *op = node->data.function.opList;
+    while (op && numOps != arity) {
+        compileNode(program, op, false);
+        numOps++;
+        op = op->next;
+    }
+
+    emit(program, oper);
+    if (arity < 0)
+        emit(program, numOps);
+}
+
+// Compiles a let section and its body.
+// The let values and lambda bodies are emitted in line (and jumped over) before the
+// OP_ENTER_SCOPE that binds them.
+static void compileLetNode(BYTECODE *program, AST_NODE *node, bool tail) {
+    int firstBinding = program->numBindings;
+    int numBindings = 0;
+    TABLE_NODE *temp;
+
+    // reserve the bindings first so they stay contiguous when the values contain let sections of their own
+    for (temp = node->data.let.symbolTable; temp; temp = temp->next) {
+        addBinding(program, temp);
+        numBindings++;
+    }
+
+    emit(program, OP_JUMP);
+    int jump = emit(program, 0);
+
+    int i = firstBinding;
+    for (temp = node->data.let.symbolTable; temp; temp = temp->next, ++i) {
+        program->bindings[i].entry = program->codeSize;
+        if (temp->nodeType == FUNC_TABLE_NODE_TYPE) {
+            // the arguments are bound by OP_CALL
+            compileNode(program, temp->data.function.customOper, true);
+        } else {
+            compileNode(program, temp->data.symbol.val, false);
+            if (temp->type == INT_TYPE && temp->valueType == DOUBLE_TYPE) {
+                // known now, so warned about once now rather than each time the value is computed
+                fprintf(cilisp->out, "WARNING: precision loss in the assignment for variable %s\n",
+                        atomName(temp->ident));
+                emit(program, OP_ROUND);
+            } else if (temp->type == INT_TYPE && temp->valueType != INT_TYPE) {
+                emit(program, OP_CHECK_INT);
+                emit(program, i);
+            }
+        }
+        emit(program, OP_RETURN);
+    }
+    program->code[jump] = program->codeSize;
+
+    emit(program, OP_ENTER_SCOPE);
+    emit(program, firstBinding);
+    emit(program, numBindings);
+
+    // read and rand values are forced on entry, see createLetScope()
+    i = 0;
+    for (temp = node->data.let.symbolTable; temp; temp = temp->next, ++i) {
+        if (temp->nodeType == SYMBOL_TABLE_NODE_TYPE && isEagerValue(temp->data.symbol.val)) {
+            emit(program, OP_LOAD_LOCAL);
+            emit(program, 0);
+            emit(program, i);
+            emit(program, OP_POP);
+        }
+    }
+
+    // a tail call leaves the scope itself, see OP_TAIL_CALL
+    compileNode(program, node->data.let.body, tail);
+    emit(program, OP_LEAVE_SCOPE);
+}
+
+static void compileNode(BYTECODE *program, AST_NODE *node, bool tail) {
+    int jump;
+
+    if (!node) {
+        emit(program, OP_LOAD_CONST);
+        emit(program, addConstant(program, intValue(NO_INT)));
+        return;
+    }
+
+    switch (node->type) {
+        case NUM_NODE_TYPE:
+            emit(program, OP_LOAD_CONST);
+            emit(program, addConstant(program, node->data.number));
+            break;
+        case SYMBOL_NODE_TYPE:
+            emit(program, OP_LOAD_LOCAL);
+            emit(program, node->data.symbol.depth);
+            emit(program, node->data.symbol.slot);
+            break;
+        case COND_NODE_TYPE:
+            compileNode(program, node->data.condition.cond, false);
+            emit(program, OP_JUMP_IF_FALSE);
+            jump = emit(program, 0);
+            compileNode(program, node->data.condition.ifTrue, tail);
+            program->code[jump] = program->codeSize + 2;
+            emit(program, OP_JUMP);
+            jump = emit(program, 0);
+            compileNode(program, node->data.condition.ifFalse, tail);
+            program->code[jump] = program->codeSize;
+            break;
+        case FUNC_NODE_TYPE:
+            compileFuncNode(program, node, tail);
+            break;
+        case LET_NODE_TYPE:
+            compileLetNode(program, node, tail);
+            break;
+        default:
+            yyerror("Invalid AST_NODE_TYPE, probably invalid writes somewhere!");
+            break;
+    }
+}
+
+// Lowers the tree rooted at node into bytecode for run().
+// The tree must have been through resolve() first.
+BYTECODE *compile(AST_NODE *node) {
+    BYTECODE *program;
+    if ((program = calloc(sizeof(BYTECODE), 1)) == NULL)
+        yyerror("Memory allocation failed!");
+
+    compileNode(program, node, false);
+    emit(program, OP_HALT);
+
+    return program;
+}
+
+void freeBytecode(BYTECODE *program) {
+    if (!program)
+        return;
+
+    free(program->code);
+    free(program->constants);
+    free(program->bindings);
+    free(program);
+}
+
+// The value and call stacks of one interpreter (see CILISP). They are kept between runs so steady state
+// evaluation does not allocate them; nothing is left on them between runs.
+struct vm {
+    RET_VAL *stack;
+    int stackSize;
+    int stackCapacity;
+
+    // Boxes for the big integers on the value stack: one on stack[i] is kept in bigs[i], and one in a slot
+    // in the slot's own, so a loop making big integers runs in constant memory like any other.
+    // Only the constants' boxes are in the arena (see boxInt()).
+    int64_t *bigs;
+
+    FRAME *frames;
+    int numFrames;
+    int frameCapacity;
+
+    // Where the arena was when run() started. Builtins called by run() box big integer results in the arena,
+    // push() moves them into bigs, so anything allocated after this point is garbage once it is pushed.
+    ARENA_MARK runMark;
+};
+
+void freeVM(VM *vm) {
+    if (!vm)
+        return;
+
+    free(vm->stack);
+    free(vm->bigs);
+    free(vm->frames);
+    free(vm);
+}
+
+static void growStack(VM *vm) {
+    vm->stackCapacity = vm->stackCapacity ? 2 * vm->stackCapacity : 256;
+    if ((vm->stack = realloc(vm->stack, vm->stackCapacity * sizeof(RET_VAL))) == NULL
+        || (vm->bigs = realloc(vm->bigs, vm->stackCapacity * sizeof(int64_t))) == NULL)
+        yyerror("Memory allocation failed!");
+
+    // the boxes have moved with bigs
+    for (int i = 0; i < vm->stackSize; ++i) {
+        if (isBoxedInt(vm->stack[i]))
+            vm->stack[i] = boxedInt(&vm->bigs[i]);
+    }
+}
+
+static void push(VM *vm, RET_VAL value) {
+    if (vm->stackSize == vm->stackCapacity)
+        growStack(vm);
+    vm->stack[vm->stackSize] = reboxInt(value, &vm->bigs[vm->stackSize]);
+    vm->stackSize++;
+}
+
+// push(intValue(value)) without boxing a big value in the arena.
+static void pushInt(VM *vm, int64_t value) {
+    if (value == NO_INT || (value >= BOX_INT_MIN && value <= BOX_INT_MAX)) {
+        push(vm, intValue(value));
+        return;
+    }
+    if (vm->stackSize == vm->stackCapacity)
+        growStack(vm);
+    vm->bigs[vm->stackSize] = value;
+    vm->stack[vm->stackSize] = boxedInt(&vm->bigs[vm->stackSize]);
+    vm->stackSize++;
+}
+
+// Pushes what a builtin in ciLisp.c returned, and gives back the arena box it may have made.
+static void pushResult(VM *vm, RET_VAL value) {
+    push(vm, value);
+    arenaRelease(vm->runMark);
+}
+
+static void pushFrame(VM *vm, int returnAddress, ENV *env, ENV *args, SLOT *forcing) {
+    if (vm->numFrames == vm->frameCapacity) {
+        vm->frameCapacity = vm->frameCapacity ? 2 * vm->frameCapacity : 64;
+        if ((vm->frames = realloc(vm->frames, vm->frameCapacity * sizeof(FRAME))) == NULL)
+            yyerror("Memory allocation failed!");
+    }
+    vm->frames[vm->numFrames++] = (FRAME) {returnAddress, env, args, forcing};
+}
+
+// Scopes are strictly nested, so they live on the frame stack (see framePush()) and
+// entering a let section or calling a lambda doesn't allocate in steady state.
+static ENV *createEnv(ENV *parent, int numSlots) {
+    ENV *env;
+    if ((env = framePush(sizeof(ENV) + numSlots * sizeof(SLOT))) == NULL)
+        yyerror("Memory allocation failed!");
+
+    env->parent = parent;
+    env->numSlots = numSlots;
+    return env;
+}
+
+static SLOT *getSlot(ENV *env, int depth, int slot) {
+    while (depth--)
+        env = env->parent;
+    return &env->slots[slot];
+}
+
+// True if the function defined in the scope defining can be tail called from env, a scope of the call
+// whose arguments are args: the scopes from env up to args are popped before the callee starts,
+// which mustn't take the callee's own definition with them.
+static bool canReuseFrame(ENV *env, ENV *args, ENV *defining) {
+    for (; env; env = env->parent) {
+        if (env == defining)
+            return false;
+        if (env == args)
+            return true;
+    }
+    return false;
+}
+
+// The common case of add, sub, mult and div: two operands that hasInt(). Returns false, leaving *result alone,
+// if the int64_t result would overflow or the division is by zero; addOper() and the rest deal with those.
+static bool intArith(OPCODE opcode, int64_t a, int64_t b, int64_t *result) {
+    switch (opcode) {
+        case OP_ADD:
+            return !__builtin_add_overflow(a, b, result);
+        case OP_SUB:
+            return !__builtin_sub_overflow(a, b, result);
+        case OP_MULT:
+            return !__builtin_mul_overflow(a, b, result);
+        default:
+            if (b == 0 || (a == INT64_MIN && b == -1))
+                return false;
+            // floored, as divOper() does
+            *result = a / b - (a % b != 0 && (a < 0) != (b < 0));
+            return true;
+    }
+}
+
+// add, sub, mult and div in general.
+static RET_VAL arithOper(OPCODE opcode, RET_VAL *ops, int numOps) {
+    switch (opcode) {
+        case OP_ADD:
+            return addOper(ops, numOps);
+        case OP_SUB:
+            return subOper(ops, numOps);
+        case OP_MULT:
+            return multOper(ops, numOps);
+        default:
+            return divOper(ops, numOps);
+    }
+}
+
+// Two operands of which at least one is a DOUBLE_TYPE.
+static double doubleArith(OPCODE opcode, double a, double b) {
+    switch (opcode) {
+        case OP_ADD:
+            return a + b;
+        case OP_SUB:
+            return a - b;
+        case OP_MULT:
+            return a * b;
+        default:
+            return a / b;
+    }
+}
+
+// Executes program and returns the value of its top level expression.
+// A big integer is returned in the interpreter's value stack (see bigs), so it is good until its next run().
+RET_VAL run(BYTECODE *program) {
+    VM *vm = cilisp->vm;
+    int *code = program->code;
+    int ip = 0;
+    ENV *env = NULL;
+    ENV *temp;
+    SLOT *slot, callee;
+    RET_VAL a, b;
+    int64_t result;
+    int numOps, i, eager;
+    OPCODE opcode;
+
+    if (!vm && (vm = cilisp->vm = calloc(1, sizeof(VM))) == NULL)
+        yyerror("Memory allocation failed!");
+    vm->stackSize = 0;
+    vm->numFrames = 0;
+    vm->runMark = arenaMark();
+
+    while (true) {
+        opcode = code[ip++];
+        switch (opcode) {
+            case OP_READ:
+                pushResult(vm, myRead());
+                break;
+            case OP_RAND:
+                push(vm, myRand());
+                break;
+
+            case OP_NEG:
+            case OP_ABS:
+            case OP_EXP:
+            case OP_SQRT:
+            case OP_LOG:
+            case OP_EXP2:
+            case OP_CBRT:
+                a = vm->stack[--vm->stackSize];
+                pushResult(vm, unaryOper((OPER_TYPE) opcode, a));
+                break;
+
+            case OP_EQUAL:
+            case OP_LESS:
+            case OP_GREATER:
+                b = vm->stack[--vm->stackSize];
+                a = vm->stack[--vm->stackSize];
+                if (hasInt(a) && hasInt(b))
+                    push(vm, intValue(opcode == OP_EQUAL ? intOf(a) == intOf(b)
+                                  : opcode == OP_LESS ? intOf(a) < intOf(b) : intOf(a) > intOf(b)));
+                else
+                    pushResult(vm, binaryOper((OPER_TYPE) opcode, a, b));
+                break;
+            case OP_REMAINDER:
+            case OP_POW:
+            case OP_MAX:
+            case OP_MIN:
+            case OP_HYPOT:
+                b = vm->stack[--vm->stackSize];
+                a = vm->stack[--vm->stackSize];
+                pushResult(vm, binaryOper((OPER_TYPE) opcode, a, b));
+                break;
+
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MULT:
+            case OP_DIV:
+                numOps = code[ip++];
+                vm->stackSize -= numOps;
+                if (numOps == 2) {
+                    a = vm->stack[vm->stackSize];
+                    b = vm->stack[vm->stackSize + 1];
+                    if (hasInt(a) && hasInt(b)) {
+                        if (intArith(opcode, intOf(a), intOf(b), &result)) {
+                            pushInt(vm, result);
+                            break;
+                        }
+                    } else if (numType(a) != INT_TYPE || numType(b) != INT_TYPE) {
+                        push(vm, doubleValue(doubleArith(opcode, numValue(a), numValue(b))));
+                        break;
+                    }
+                }
+                pushResult(vm, arithOper(opcode, &vm->stack[vm->stackSize], numOps));
+                break;
+
+            case OP_EQUAL_INT:
+            case OP_LESS_INT:
+            case OP_GREATER_INT:
+                vm->stackSize -= 2;
+                a = vm->stack[vm->stackSize];
+                b = vm->stack[vm->stackSize + 1];
+                opcode = OP_EQUAL + opcode - OP_EQUAL_INT;
+                if (hasInt(a) && hasInt(b))
+                    push(vm, intValue(opcode == OP_EQUAL ? intOf(a) == intOf(b)
+                                  : opcode == OP_LESS ? intOf(a) < intOf(b) : intOf(a) > intOf(b)));
+                else
+                    pushResult(vm, binaryOper((OPER_TYPE) opcode, a, b));
+                break;
+            case OP_ADD_INT:
+            case OP_SUB_INT:
+            case OP_MULT_INT:
+            case OP_DIV_INT:
+                vm->stackSize -= 2;
+                a = vm->stack[vm->stackSize];
+                b = vm->stack[vm->stackSize + 1];
+                opcode = OP_ADD + opcode - OP_ADD_INT;
+                if (hasInt(a) && hasInt(b) && intArith(opcode, intOf(a), intOf(b), &result))
+                    pushInt(vm, result);
+                else
+                    pushResult(vm, arithOper(opcode, &vm->stack[vm->stackSize], 2));
+                break;
+            case OP_EQUAL_DOUBLE:
+                vm->stackSize--;
+                b = vm->stack[vm->stackSize];
+                vm->stack[vm->stackSize - 1] = doubleValue(doubleOf(vm->stack[vm->stackSize - 1]) == doubleOf(b));
+                break;
+            case OP_LESS_DOUBLE:
+                vm->stackSize--;
+                b = vm->stack[vm->stackSize];
+                vm->stack[vm->stackSize - 1] = doubleValue(doubleOf(vm->stack[vm->stackSize - 1]) < doubleOf(b));
+                break;
+            case OP_GREATER_DOUBLE:
+                vm->stackSize--;
+                b = vm->stack[vm->stackSize];
+                vm->stack[vm->stackSize - 1] = doubleValue(doubleOf(vm->stack[vm->stackSize - 1]) > doubleOf(b));
+                break;
+            case OP_ADD_DOUBLE:
+                vm->stackSize--;
+                b = vm->stack[vm->stackSize];
+                vm->stack[vm->stackSize - 1] = doubleValue(doubleOf(vm->stack[vm->stackSize - 1]) + doubleOf(b));
+                break;
+            case OP_SUB_DOUBLE:
+                vm->stackSize--;
+                b = vm->stack[vm->stackSize];
+                vm->stack[vm->stackSize - 1] = doubleValue(doubleOf(vm->stack[vm->stackSize - 1]) - doubleOf(b));
+                break;
+            case OP_MULT_DOUBLE:
+                vm->stackSize--;
+                b = vm->stack[vm->stackSize];
+                vm->stack[vm->stackSize - 1] = doubleValue(doubleOf(vm->stack[vm->stackSize - 1]) * doubleOf(b));
+                break;
+            case OP_DIV_DOUBLE:
+                vm->stackSize--;
+                b = vm->stack[vm->stackSize];
+                vm->stack[vm->stackSize - 1] = doubleValue(doubleOf(vm->stack[vm->stackSize - 1]) / doubleOf(b));
+                break;
+
+            case OP_PRINT:
+                numOps = code[ip++];
+                if (numOps == 0) {
+                    fprintf(cilisp->out, "\n");
+                    push(vm, noValue());
+                    break;
+                }
+                fprintf(cilisp->out, "=> ");
+                vm->stackSize -= numOps;
+                for (i = 0; i < numOps; ++i) {
+                    a = vm->stack[vm->stackSize + i];
+                    switch (numType(a)) {
+                        case INT_TYPE:
+                            fprintf(cilisp->out, "Integer: %ld ", (long) intOf(a));
+                            break;
+                        case DOUBLE_TYPE:
+                            fprintf(cilisp->out, "Double: %f ", doubleOf(a));
+                            break;
+                        default:
+                            yyerror("Invalid Type Error in print\n");
+                            break;
+                    }
+                }
+                fprintf(cilisp->out, "\n");
+                push(vm, vm->stack[vm->stackSize + numOps - 1]); // the value of a print is its last operand
+                break;
+
+            case OP_LOAD_CONST:
+                push(vm, program->constants[code[ip++]]);
+                break;
+            case OP_LOAD_LOCAL:
+                slot = getSlot(env, code[ip], code[ip + 1]);
+                ip += 2;
+                if (slot->nodeType == FUNC_TABLE_NODE_TYPE) {
+                    push(vm, intValue(NO_INT));
+                } else if (slot->entry < 0) {
+                    push(vm, slot->value);
+                } else {
+                    pushFrame(vm, ip, env, NULL, slot->byName ? NULL : slot);
+                    env = slot->env;
+                    ip = slot->entry;
+                }
+                break;
+            case OP_JUMP_IF_FALSE:
+                a = vm->stack[--vm->stackSize];
+                if (numValue(a) == 0)
+                    ip = code[ip];
+                else
+                    ip++;
+                break;
+            case OP_JUMP:
+                ip = code[ip];
+                break;
+            case OP_ENTER_SCOPE:
+                numOps = code[ip + 1];
+                temp = createEnv(env, numOps);
+                for (i = 0; i < numOps; ++i) {
+                    BINDING *binding = &program->bindings[code[ip] + i];
+                    temp->slots[i] = (SLOT) {binding->nodeType, binding->entry, binding->numParams, temp,
+                                             intValue(NO_INT), false};
+                }
+                env = temp;
+                ip += 2;
+                break;
+            case OP_LEAVE_SCOPE:
+                temp = env;
+                env = env->parent;
+                framePop(temp);
+                break;
+            case OP_TAIL_CALL:
+            case OP_CALL:
+                callee = *getSlot(env, code[ip], code[ip + 1]); // the slot itself may be popped by a tail call
+                numOps = code[ip + 2];
+                ip += 3;
+
+                // resolve() rejected calls with fewer operands than parameters; extra ones are dropped here
+                vm->stackSize -= numOps;
+                if (opcode == OP_TAIL_CALL && canReuseFrame(env, vm->frames[vm->numFrames - 1].args, callee.env)) {
+                    // the callee returns straight to our caller: our scopes go now instead of when we return,
+                    // and its arguments take their place (the operands are still on the value stack)
+                    framePop(vm->frames[vm->numFrames - 1].args);
+                    temp = createEnv(callee.env, callee.numParams);
+                    vm->frames[vm->numFrames - 1].args = temp;
+                } else {
+                    temp = createEnv(callee.env, callee.numParams);
+                    pushFrame(vm, ip, env, temp, NULL);
+                }
+                for (i = 0; i < callee.numParams; ++i) {
+                    temp->slots[i] = (SLOT) {SYMBOL_TABLE_NODE_TYPE, -1, 0, NULL, intValue(NO_INT), false};
+                    temp->slots[i].value = reboxInt(vm->stack[vm->stackSize + i], &temp->slots[i].big);
+                }
+
+                env = temp;
+                ip = callee.entry;
+                break;
+            case OP_CALL_BY_NAME:
+                slot = getSlot(env, code[ip], code[ip + 1]);
+                numOps = code[ip + 2];
+                ip += 3;
+
+                // operands without a thunk (entry -1) were evaluated before the call and are on the stack
+                for (i = 0, eager = 0; i < numOps; ++i)
+                    eager += code[ip + i] < 0;
+                vm->stackSize -= eager;
+
+                temp = createEnv(slot->env, slot->numParams);
+                for (i = 0, eager = vm->stackSize; i < slot->numParams; ++i) {
+                    if (code[ip + i] < 0) {
+                        temp->slots[i] = (SLOT) {SYMBOL_TABLE_NODE_TYPE, -1, 0, NULL, intValue(NO_INT), false};
+                        temp->slots[i].value = reboxInt(vm->stack[eager++], &temp->slots[i].big);
+                    } else {
+                        temp->slots[i] = (SLOT) {SYMBOL_TABLE_NODE_TYPE, code[ip + i], 0, env,
+                                                 intValue(NO_INT), true};
+                    }
+                }
+
+                pushFrame(vm, ip + numOps, env, temp, NULL);
+                env = temp;
+                ip = slot->entry;
+                break;
+            case OP_CHECK_INT:
+                a = vm->stack[vm->stackSize - 1];
+                if (numType(a) == DOUBLE_TYPE) {
+                    fprintf(cilisp->out, "WARNING: precision loss in the assignment for variable %s\n",
+                            atomName(program->bindings[code[ip]].ident));
+                    vm->stack[vm->stackSize - 1] = doubleValue(round(doubleOf(a)));
+                }
+                ip++;
+                break;
+            case OP_ROUND:
+                vm->stack[vm->stackSize - 1] = doubleValue(round(doubleOf(vm->stack[vm->stackSize - 1])));
+                break;
+            case OP_POP:
+                vm->stackSize--;
+                break;
+            case OP_RETURN:
+                vm->numFrames--;
+                if (vm->frames[vm->numFrames].args)
+                    framePop(vm->frames[vm->numFrames].args);
+                if ((slot = vm->frames[vm->numFrames].forcing)) {
+                    slot->value = reboxInt(vm->stack[vm->stackSize - 1], &slot->big);
+                    slot->entry = -1;
+                }
+                env = vm->frames[vm->numFrames].env;
+                ip = vm->frames[vm->numFrames].returnAddress;
+                break;
+            case OP_HALT:
+                return vm->stack[--vm->stackSize];
+            default:
+                yyerror("Invalid opcode, probably invalid writes somewhere!");
+                return intValue(NO_INT);
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __cilisp_vm_h_
+#define __cilisp_vm_h_
+
+#include "ciLisp.h"
+
+// Opcodes understood by run().
+// The builtin opcodes must stay in sync with OPER_TYPE so that compile() can emit
+// a FUNC_NODE_TYPE's oper directly. Operands follow the opcode in the code array.
+typedef enum {
+    OP_READ = READ_OPER,
+    OP_RAND = RAND_OPER,
+
+    OP_NEG = NEG_OPER,
+    OP_ABS = ABS_OPER,
+    OP_EXP = EXP_OPER,
+    OP_SQRT = SQRT_OPER,
+    OP_LOG = LOG_OPER,
+    OP_EXP2 = EXP2_OPER,
+    OP_CBRT = CBRT_OPER,
+
+    OP_REMAINDER = REMAINDER_OPER,
+    OP_POW = POW_OPER,
+    OP_MAX = MAX_OPER,
+    OP_MIN = MIN_OPER,
+    OP_HYPOT = HYPOT_OPER,
+    OP_EQUAL = EQUAL_OPER,
+    OP_LESS = LESS_OPER,
+    OP_GREATER = GREATER_OPER,
+
+    OP_ADD = ADD_OPER,          // [numOps]
+    OP_SUB = SUB_OPER,          // [numOps]
+    OP_MULT = MULT_OPER,        // [numOps]
+    OP_DIV = DIV_OPER,          // [numOps]
+    OP_PRINT = PRINT_OPER,      // [numOps]
+
+    OP_LOAD_CONST,              // [constant]
+    OP_LOAD_LOCAL,              // [depth] [slot], runs the slot's thunk the first time
+    OP_POP,
+    OP_JUMP_IF_FALSE,           // [target]
+    OP_JUMP,                    // [target]
+    OP_ENTER_SCOPE,             // [firstBinding] [numBindings]
+    OP_LEAVE_SCOPE,
+    OP_CALL,                    // [depth] [slot] [numArgs], arguments on the stack
+    OP_TAIL_CALL,               // [depth] [slot] [numArgs], OP_CALL reusing the calling lambda's frame
+    OP_CALL_BY_NAME,            // [depth] [slot] [numArgs] [argEntry]..., -1 entries' values on the stack
+    OP_CHECK_INT,               // [binding]
+    OP_ROUND,                   // OP_CHECK_INT on a value inferTypes() knows is a DOUBLE_TYPE, warned about by compile()
+
+    // Builtins on two operands that inferTypes() gave the same type, in the same order as their OPER_TYPEs.
+    // The DOUBLE_TYPE ones skip the type checks altogether; the INT_TYPE ones only check for NO_INT,
+    // integers too big for the payload, and overflow.
+    OP_EQUAL_INT,
+    OP_LESS_INT,
+    OP_GREATER_INT,
+    OP_ADD_INT,
+    OP_SUB_INT,
+    OP_MULT_INT,
+    OP_DIV_INT,
+    OP_EQUAL_DOUBLE,
+    OP_LESS_DOUBLE,
+    OP_GREATER_DOUBLE,
+    OP_ADD_DOUBLE,
+    OP_SUB_DOUBLE,
+    OP_MULT_DOUBLE,
+    OP_DIV_DOUBLE,
+
+    OP_RETURN,
+    OP_HALT
+} OPCODE;
+
+// Compile-time description of one entry of a let section.
+// OP_ENTER_SCOPE turns a run of these into the slots of a new scope.
+typedef struct {
+    TABLE_NODE_TYPE nodeType;
+    ATOM ident;
+    NUM_TYPE type;
+    int entry; // code offset of the value thunk or of the lambda body
+    int numParams; // only used by FUNC_TABLE_NODE_TYPE
+} BINDING;
+
+// A compiled top level expression.
+// Thunks for let values and custom function arguments, and lambda bodies, live in the
+// same code array as the expression itself and end in OP_RETURN.
+typedef struct {
+    int *code;
+    int codeSize;
+    int codeCapacity;
+
+    RET_VAL *constants;
+    int numConstants;
+    int constantCapacity;
+
+    BINDING *bindings;
+    int numBindings;
+    int bindingCapacity;
+} BYTECODE;
+
+BYTECODE *compile(AST_NODE *node);
+RET_VAL run(BYTECODE *program);
+void freeBytecode(BYTECODE *program);
+void freeVM(VM *vm);
+
+#endif